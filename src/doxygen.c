@@ -20,8 +20,10 @@
  *     @defgroup elf ELF
  *     @defgroup schedule Schedule
  *     @defgroup task Task
+ *     @defgroup timer Timer
  *     @defgroup tss TSS
  *     @defgroup vm86 VM86
+ *     @defgroup wait Wait Queue
  *   @}
  * @}
  */
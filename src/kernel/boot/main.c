@@ -1,10 +1,14 @@
 #include <common.h>
 #include <boot/multiboot.h>
 #include <hardware/cpu/cpuid.h>
+#include <hardware/cpu/fpu.h>
+#include <hardware/cpu/smp.h>
+#include <hardware/cpu/tsc.h>
 #include <hardware/io/keyboard.h>
 #include <hardware/io/mouse.h>
 #include <hardware/io/ps2.h>
 #include <hardware/pit.h>
+#include <interrupts/deferred.h>
 #include <interrupts/idt.h>
 #include <interrupts/isr.h>
 #include <interrupts/pic.h>
@@ -37,26 +41,31 @@ void main(multiboot_info_t* mb_info, uint32_t mb_magic) {
     lib_init(io_putchar, io_attr); // tell the library how to print to screen
     io_clear(io_putchar); // clear any messages GRUB left us
     println("%15aWelcome!%a");
+    gdt_init(); // Global Descriptor Table - flat memory model and per-CPU data
     multiboot_init(mb_info, mb_magic); // Multiboot - info passed by bootloader
     pmm_init(); // Physical Memory Manager - info on free and used memory
     vmm_init(); // Virtual Memory Manager - enable paging
     // at this point we can allocate virtual memory with vmm_alloc
-    gdt_init(); // Global Descriptor Table - flat memory model
     cpuid_init(); // CPUID - gather information about the CPU
     idt_init(); // Interrupt Descriptor Table - set up ISRs
+    fpu_init(); // Floating Point Unit - lazy FPU/SSE state switching
     pic_init(); // Programmable Interrupt Controller - remap IRQs
     // at this point we can use exceptions and syscalls
     pit_init(50); // Programmable Interval Timer - system clock
+    tsc_init(); // Time Stamp Counter - high-resolution clock, calibrated with the PIT
     vm86_init(); // Virtual 8086 Mode - run 16-bit code
     isr_init(); // enable interrupts
+    schedule_init(); // Scheduler - create the idle task
+    deferred_init(); // Deferred Work - device handlers outside of IRQs
     // hand over further initialization to multitasking-land main2
-    task_create_kernel(main2, 0, STACK_SIZE);
+    task_create_kernel_thread(main2, STACK_SIZE);
     asm volatile("hlt"); // stop execution until the scheduler calls main2
 }
 
 static void main2() {
     logln("MAIN", "Entering main2");
-    task_create_kernel(ps2, 0, _4KB);
+    smp_init(); // Symmetric Multiprocessing - start the other CPUs
+    task_create_kernel_thread(ps2, _4KB);
     isr_registers_t registers = {.eax = 0x0f00}; // get the VGA video mode
     vm86_call_bios(0x10, &registers); // (only for testing VM86 mode)
     for (int i = 0; i < 10; i++)
@@ -69,8 +78,12 @@ static void main2() {
         pit_dump_time();
         io_cursor(old_cursor);
         task_dump();
-        schedule_finalize_tasks(); // clean up any tasks marked for removal
-        pit_sleep(1000);
+        schedule_dump();
+        mmu_dump();
+        isr_dump_lock();
+        isr_dump_stats();
+        deferred_dump();
+        task_sleep(1000);
     }
     
     io_cursor(IO_COORD(16, IO_ROWS / 2 - 2)); println("=================================================");
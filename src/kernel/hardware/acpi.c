@@ -0,0 +1,181 @@
+/*
+ * ACPI - tables describing the hardware
+ *
+ * We don't interpret AML, we only look for the MADT which lists the processors
+ * and their local APICs, the I/O APIC and how the ISA IRQs are wired to it.
+ * The RSDP is searched in the BIOS area only, that's where QEMU and Bochs put
+ * it (it may also lie in the EBDA on real hardware).
+ *
+ * http://wiki.osdev.org/RSDP
+ * http://wiki.osdev.org/RSDT
+ * http://wiki.osdev.org/MADT
+ * http://www.lowlevel.eu/wiki/ACPI
+ */
+
+#include <common.h>
+#include <hardware/acpi.h>
+#include <mem/vmm.h>
+#include <string.h>
+
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END   0x100000
+#define RSDP_SIGNATURE  "RSD PTR "
+#define MADT_SIGNATURE  "APIC"
+#define MADT_LAPIC      0 // entry type for a processor's local APIC
+#define MADT_IOAPIC     1 // entry type for an I/O APIC
+#define MADT_OVERRIDE   2 // entry type for an ISA IRQ not wired to the same GSI
+#define BUS_ISA         0
+#define LAPIC_ENABLED   1 // the processor may be used
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum; // all bytes of the RSDP sum up to 0
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address; // physical address of the RSDT
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length; // including this header
+    uint8_t revision;
+    uint8_t checksum; // all bytes of the table sum up to 0
+    char oem_id[6], oem_table_id[8];
+    uint32_t oem_revision, creator_id, creator_revision;
+} __attribute__((packed)) acpi_header_t; // common to all tables
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address, flags;
+} __attribute__((packed)) acpi_madt_header_t; // followed by the entries
+
+typedef struct {
+    uint8_t type, length;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t processor_id, lapic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t ioapic_id, reserved;
+    uint32_t ioapic_address, gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t bus, irq;
+    uint32_t gsi;
+    uint16_t flags; // polarity and trigger mode
+} __attribute__((packed)) acpi_madt_override_t;
+
+static acpi_madt_t madt = {0};
+
+static uint8_t acpi_checksum(void* ptr, size_t len) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += ((uint8_t*) ptr)[i];
+    return sum;
+}
+
+// maps physical memory that is not necessarily page-aligned
+static void* acpi_map(uint32_t paddr, size_t len) {
+    uint32_t offset = paddr & 0xFFF;
+    uint8_t* vaddr = vmm_map_physical_memory((void*) (paddr - offset),
+            len + offset, VMM_KERNEL);
+    return vaddr ? vaddr + offset : 0;
+}
+
+static void acpi_unmap(void* vaddr, size_t len) {
+    uint32_t offset = (uintptr_t) vaddr & 0xFFF;
+    vmm_unmap_physical_memory((uint8_t*) vaddr - offset, len + offset);
+}
+
+// maps a whole table, we need to look at the header to know its length
+static acpi_header_t* acpi_map_table(uint32_t paddr) {
+    acpi_header_t* header = acpi_map(paddr, sizeof(acpi_header_t));
+    uint32_t length = header->length;
+    acpi_unmap(header, sizeof(acpi_header_t));
+    header = acpi_map(paddr, length);
+    if (acpi_checksum(header, length)) {
+        acpi_unmap(header, length);
+        return 0;
+    }
+    return header;
+}
+
+static uint32_t acpi_find_rsdt() {
+    uint32_t rsdt_address = 0;
+    uint8_t* area = acpi_map(BIOS_AREA_START, BIOS_AREA_END - BIOS_AREA_START);
+    for (uint32_t i = 0; i < BIOS_AREA_END - BIOS_AREA_START; i += 16) { // the RSDP
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*) (area + i); // is 16-byte aligned
+        if (!memcmp(rsdp->signature, RSDP_SIGNATURE, sizeof(rsdp->signature)) &&
+                !acpi_checksum(rsdp, sizeof(acpi_rsdp_t))) {
+            rsdt_address = rsdp->rsdt_address;
+            break;
+        }
+    }
+    acpi_unmap(area, BIOS_AREA_END - BIOS_AREA_START);
+    return rsdt_address;
+}
+
+static void acpi_parse_madt(acpi_madt_header_t* header) {
+    madt.lapic_address = (void*) header->lapic_address;
+    for (int i = 0; i < ACPI_ISA_IRQS; i++) // unless overridden, IRQ i is GSI i
+        madt.irq_gsi[i] = i;
+    uint8_t* ptr = (uint8_t*) (header + 1), *end = (uint8_t*) header + header->header.length;
+    for (acpi_madt_entry_t* entry; ptr < end; ptr += entry->length) {
+        entry = (acpi_madt_entry_t*) ptr;
+        if (!entry->length)
+            break; // broken table, don't loop forever
+        acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*) entry;
+        acpi_madt_ioapic_t* ioapic = (acpi_madt_ioapic_t*) entry;
+        acpi_madt_override_t* override = (acpi_madt_override_t*) entry;
+        if (entry->type == MADT_LAPIC && (lapic->flags & LAPIC_ENABLED) &&
+                madt.processors < ACPI_MAX_PROCESSORS)
+            madt.lapic_ids[madt.processors++] = lapic->lapic_id;
+        if (entry->type == MADT_IOAPIC && !madt.ioapic_address) {
+            madt.ioapic_address = (void*) ioapic->ioapic_address;
+            madt.ioapic_gsi_base = ioapic->gsi_base;
+        }
+        if (entry->type == MADT_OVERRIDE && override->bus == BUS_ISA &&
+                override->irq < ACPI_ISA_IRQS) {
+            madt.irq_gsi[override->irq] = override->gsi;
+            madt.irq_flags[override->irq] = override->flags;
+        }
+    }
+}
+
+uint8_t acpi_init() {
+    print("ACPI init ... ");
+    uint32_t rsdt_address = acpi_find_rsdt();
+    acpi_header_t* rsdt;
+    if (!rsdt_address || !(rsdt = acpi_map_table(rsdt_address))) {
+        println("%4afail%a. No ACPI tables found.");
+        return 0;
+    }
+    uint32_t* tables = (uint32_t*) (rsdt + 1); // physical addresses of the tables
+    uint32_t table_number = (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < table_number; i++) {
+        acpi_header_t* header = acpi_map_table(tables[i]);
+        if (!header)
+            continue;
+        if (!memcmp(header->signature, MADT_SIGNATURE, sizeof(header->signature)))
+            acpi_parse_madt((acpi_madt_header_t*) header);
+        acpi_unmap(header, header->length);
+    }
+    acpi_unmap(rsdt, rsdt->length);
+    if (!madt.processors) {
+        println("%4afail%a. No MADT found.");
+        return 0;
+    }
+    println("%2aok%a. %d processor%s.", madt.processors, madt.processors == 1 ? "" : "s");
+    return 1;
+}
+
+acpi_madt_t* acpi_get_madt() {
+    return &madt;
+}
@@ -0,0 +1,22 @@
+#ifndef HARDWARE_ACPI_H
+#define HARDWARE_ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_PROCESSORS 16
+#define ACPI_ISA_IRQS       16
+
+typedef struct {
+    void* lapic_address; // physical address of the local APICs
+    uint8_t processors;  // number of enabled processors
+    uint8_t lapic_ids[ACPI_MAX_PROCESSORS]; // their local APIC IDs
+    void* ioapic_address;     // physical address of the first I/O APIC, 0 if there is none
+    uint32_t ioapic_gsi_base; // the first global system interrupt it handles
+    uint32_t irq_gsi[ACPI_ISA_IRQS];   // the global system interrupt an ISA IRQ is wired to
+    uint16_t irq_flags[ACPI_ISA_IRQS]; // its polarity and trigger mode, 0 for the ISA default
+} acpi_madt_t; // what we need from the Multiple APIC Description Table
+
+uint8_t acpi_init();
+acpi_madt_t* acpi_get_madt();
+
+#endif
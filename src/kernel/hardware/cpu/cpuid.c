@@ -1,5 +1,6 @@
 #include <common.h>
 #include <hardware/cpu/cpuid.h>
+#include <string.h>
 
 /*
  * CPUID - info on the CPU
@@ -22,14 +23,6 @@ typedef struct {
     uint32_t eax, ebx, ecx, edx;
 } cpuid_result_t;
 
-typedef struct {
-    uint8_t stepping : 4, model : 4, family : 4, type : 2, : 2, model_ext : 4, family_ext : 8, : 4; // EAX
-    uint8_t brand_id : 8, clflush_size : 8, processors : 8, apic_id : 8; // EBX
-    uint8_t sse3 : 1, : 8, ssse3 : 1, : 8, : 1, sse41 : 1, sse42 : 1, : 8, : 3; // ECX
-    uint8_t fpu : 1, vme : 1, : 1, pse : 1, : 2, pae : 1, : 2, apic : 1, : 7, pse36 : 1, : 1,
-            clflush : 1, : 2, acpi : 1, mmx : 1, : 1, sse : 1, sse2 : 1, : 1, htt : 1, : 3; // EDX
-} __attribute__((packed)) cpuid_features_t;
-
 extern uint32_t cpuid_check();
 extern cpuid_result_t* cpuid_call(uint32_t function, cpuid_result_t* res);
 
@@ -74,6 +67,11 @@ void cpuid_name(cpuid_result_t* res) {
 
 // DO NOT make this local, leads to weird behaviour (I have no idea why). Works this way for now.
 static cpuid_result_t res;
+static cpuid_features_t features = {0}; // all zero if CPUID is not available
+
+cpuid_features_t* cpuid_get_features() {
+    return &features;
+}
 
 void cpuid_init() {
     print("CPUID init ... ");
@@ -84,24 +82,28 @@ void cpuid_init() {
         cpuid_name(cpuid_call(CPUID_NAME3, &res));
         print(" by ");
         cpuid_vendor(cpuid_call(CPUID_VENDOR, &res));
-        cpuid_features_t* features = (cpuid_features_t*) cpuid_call(CPUID_FEATURES, &res);
-        if (features->sse)     print(", SSE");
-        if (features->sse2)    print(", SSE2");
-        if (features->sse3)    print(", SSE3");
-        if (features->ssse3)   print(", SSSE3");
-        if (features->sse41)   print(", SSE4.1");
-        if (features->sse42)   print(", SSE4.2");
-        if (features->fpu)     print(", FPU");
-        if (features->pae)     print(", PAE");
-        if (features->mmx)     print(", MMX");
-        if (features->vme)     print(", VME");
-        if (features->apic)    print(", APIC");
-        if (features->acpi)    print(", ACPI");
-        if (features->pse)     print(", PSE");
-        if (features->pse36)   print(", PSE-36");
-        if (features->clflush) print(", CLFLUSH");
-        if (features->htt)
-            println(", hyperthreading with %d processor(s).", features->processors);
+        memcpy(&features, cpuid_call(CPUID_FEATURES, &res), sizeof(features));
+        if (features.sse)     print(", SSE");
+        if (features.sse2)    print(", SSE2");
+        if (features.sse3)    print(", SSE3");
+        if (features.ssse3)   print(", SSSE3");
+        if (features.sse41)   print(", SSE4.1");
+        if (features.sse42)   print(", SSE4.2");
+        if (features.fpu)     print(", FPU");
+        if (features.pae)     print(", PAE");
+        if (features.mmx)     print(", MMX");
+        if (features.vme)     print(", VME");
+        if (features.apic)    print(", APIC");
+        if (features.acpi)    print(", ACPI");
+        if (features.pse)     print(", PSE");
+        if (features.pse36)   print(", PSE-36");
+        if (features.clflush) print(", CLFLUSH");
+        if (features.tsc)     print(", TSC");
+        if (features.msr)     print(", MSR");
+        if (features.sep)     print(", SEP");
+        if (features.fxsr)    print(", FXSR");
+        if (features.htt)
+            println(", hyperthreading with %d processor(s).", features.processors);
         else
             println(", no hyperthreading.");
     } else
@@ -1,6 +1,18 @@
 #ifndef HARDWARE_CPU_CPUID_H
 #define HARDWARE_CPU_CPUID_H
 
+#include <stdint.h>
+
+typedef struct {
+    uint8_t stepping : 4, model : 4, family : 4, type : 2, : 2, model_ext : 4, family_ext : 8, : 4; // EAX
+    uint8_t brand_id : 8, clflush_size : 8, processors : 8, apic_id : 8; // EBX
+    uint8_t sse3 : 1, : 8, ssse3 : 1, : 8, : 1, sse41 : 1, sse42 : 1, : 8, : 3; // ECX
+    uint8_t fpu : 1, vme : 1, : 1, pse : 1, tsc : 1, msr : 1, pae : 1, : 2, apic : 1, : 1, sep : 1, : 5,
+            pse36 : 1, : 1, clflush : 1, : 2, acpi : 1, mmx : 1, fxsr : 1, sse : 1, sse2 : 1, : 1,
+            htt : 1, : 3; // EDX
+} __attribute__((packed)) cpuid_features_t;
+
+cpuid_features_t* cpuid_get_features();
 void cpuid_init();
 
 #endif
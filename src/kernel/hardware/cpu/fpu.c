@@ -0,0 +1,136 @@
+/*
+ * FPU - x87 and SSE state switching
+ *
+ * Saving and restoring the FPU/SSE registers on every task switch is expensive,
+ * so we do it lazily: The FPU registers keep the state of the last task that
+ * used them (the owner). When switching to another task, we set CR0.TS, so the
+ * first FPU/SSE instruction of that task raises #NM (device not available).
+ * Only then do we save the owner's state and restore the current task's.
+ * Tasks that never touch the FPU never pay for it.
+ * Every CPU has its own FPU and owner. With several CPUs, a task might continue
+ * on another CPU, so its state is saved eagerly when it is switched out.
+ *
+ * http://wiki.osdev.org/FPU
+ * http://wiki.osdev.org/SSE
+ * http://www.lowlevel.eu/wiki/FPU
+ * http://www.felixcloutier.com/x86/FXSAVE.html
+ */
+
+#include <common.h>
+#include <hardware/cpu/fpu.h>
+#include <hardware/cpu/cpuid.h>
+#include <tasks/task.h>
+#include <tasks/schedule.h>
+#include <hardware/cpu/smp.h>
+#include <string.h>
+
+#define CR0_MP         0x00000002 // WAIT raises #NM if TS is set
+#define CR0_EM         0x00000004 // no FPU present, emulate it
+#define CR0_TS         0x00000008 // task switched, the next FPU instruction raises #NM
+#define CR0_NE         0x00000020 // report FPU errors as #MF instead of IRQ13
+#define CR4_OSFXSR     0x00000200 // enables FXSAVE/FXRSTOR and SSE
+#define CR4_OSXMMEXCPT 0x00000400 // report SSE errors as #XM
+
+static uint8_t available = 0, fxsr = 0; // whether we have a FPU and FXSAVE
+#define owner (smp_get_cpu()->fpu_owner) // whose state lies in this CPU's FPU registers
+static fpu_state_t initial_state; // clean state for tasks first using the FPU
+
+static inline uint32_t fpu_get_cr0() {
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void fpu_set_cr0(uint32_t cr0) {
+    asm volatile("mov %0, %%cr0" : : "r" (cr0));
+}
+
+static inline void fpu_save(fpu_state_t* state) {
+    if (fxsr)
+        asm volatile("fxsave (%0)" : : "r" (state) : "memory");
+    else // fnsave reinitializes the FPU, but we don't care because we restore anyway
+        asm volatile("fnsave (%0)" : : "r" (state) : "memory");
+}
+
+static inline void fpu_restore(fpu_state_t* state) {
+    if (fxsr)
+        asm volatile("fxrstor (%0)" : : "r" (state) : "memory");
+    else
+        asm volatile("frstor (%0)" : : "r" (state) : "memory");
+}
+
+// called on the first FPU/SSE instruction after a task switch
+static cpu_state_t* fpu_handle_not_available(cpu_state_t* cpu) {
+    uint32_t pid = schedule_get_current_task();
+    asm volatile("clts"); // allow FPU instructions again
+    if (!pid || pid == owner)
+        return cpu;
+    if (owner)
+        fpu_save(task_get_fpu_state(owner));
+    if (!task_get_fpu_used(pid)) { // the task's first FPU instruction
+        memcpy(task_get_fpu_state(pid), &initial_state, sizeof(fpu_state_t));
+        task_set_fpu_used(pid, 1);
+    }
+    fpu_restore(task_get_fpu_state(pid));
+    for (int i = 0; i < smp_get_cpu_number(); i++) // other CPUs' registers are
+        if (smp_get_cpu_by_id(i)->fpu_owner == pid) // outdated from now on
+            smp_get_cpu_by_id(i)->fpu_owner = 0;
+    owner = pid;
+    return cpu;
+}
+
+// called when switching tasks, makes the next FPU instruction trap if needed
+void fpu_switch_task(uint32_t old_pid, uint32_t pid) {
+    if (!available)
+        return;
+    uint32_t cr0 = fpu_get_cr0();
+    if (old_pid && old_pid == owner && old_pid != pid && smp_get_cpu_number() > 1 &&
+            !(cr0 & CR0_TS)) { // the old task might continue on another CPU
+        fpu_save(task_get_fpu_state(old_pid));
+        if (!fxsr) // fnsave reinitialized the registers
+            owner = 0;
+    }
+    if (pid == owner) // the FPU registers are still valid,
+        fpu_set_cr0(cr0 & ~CR0_TS); // so we don't need to trap
+    else if (!(cr0 & CR0_TS))
+        fpu_set_cr0(cr0 | CR0_TS);
+}
+
+// called when a task is destroyed, its FPU state is not needed anymore
+void fpu_forget_task(uint32_t pid) {
+    for (int i = 0; i < smp_get_cpu_number(); i++)
+        if (smp_get_cpu_by_id(i)->fpu_owner == pid)
+            smp_get_cpu_by_id(i)->fpu_owner = 0;
+}
+
+// sets up this CPU's FPU, the boot CPU does this in fpu_init()
+void fpu_init_cpu() {
+    if (!available)
+        return;
+    fpu_set_cr0((fpu_get_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if (fxsr) {
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r" (cr4));
+        cr4 |= CR4_OSFXSR | (cpuid_get_features()->sse ? CR4_OSXMMEXCPT : 0);
+        asm volatile("mov %0, %%cr4" : : "r" (cr4));
+    }
+    asm volatile("fninit");
+    fpu_set_cr0(fpu_get_cr0() | CR0_TS); // nobody owns the FPU yet
+}
+
+void fpu_init() {
+    print("FPU init ... ");
+    cpuid_features_t* features = cpuid_get_features();
+    if (!features->fpu) {
+        println("%4afail%a. No FPU available.");
+        return;
+    }
+    available = 1;
+    fxsr = features->fxsr;
+    fpu_init_cpu();
+    asm volatile("clts");
+    fpu_save(&initial_state); // every task starts with a clean FPU
+    isr_register_handler(ISR_EXCEPTION(0x07), fpu_handle_not_available);
+    fpu_set_cr0(fpu_get_cr0() | CR0_TS);
+    println("%2aok%a. %s.", fxsr ? "Using FXSAVE" : "Using FNSAVE");
+}
@@ -0,0 +1,16 @@
+#ifndef HARDWARE_CPU_FPU_H
+#define HARDWARE_CPU_FPU_H
+
+#include <stdint.h>
+#include <interrupts/isr.h>
+
+typedef struct {
+    uint8_t data[512]; // large enough for FXSAVE (512 bytes) and FNSAVE (108 bytes)
+} __attribute__((aligned(16))) fpu_state_t; // FXSAVE needs 16-byte alignment
+
+void fpu_init_cpu();
+void fpu_init();
+void fpu_switch_task(uint32_t old_pid, uint32_t pid);
+void fpu_forget_task(uint32_t pid);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Local APIC - per-CPU interrupt controller and timer
+ *
+ * Every CPU has a local APIC. We use it to send inter-processor interrupts
+ * (for example to start the other CPUs) and as every CPU's tick, calibrated
+ * against the PIT. The registers are memory-mapped at the same physical
+ * address on every CPU, each CPU sees its own local APIC there.
+ *
+ * The timer usually runs periodically. An idle CPU stops its tick and programs
+ * the timer in one-shot mode for the next event instead (the boot CPU for the
+ * next timer, the other CPUs for nothing at all), so it sleeps without being
+ * interrupted. When it wakes up, the ticks it slept through are counted from
+ * the timer's count. Another CPU that has work for it sends a reschedule IPI.
+ *
+ * http://wiki.osdev.org/APIC
+ * http://wiki.osdev.org/APIC_timer
+ * http://www.lowlevel.eu/wiki/APIC
+ * https://pdos.csail.mit.edu/6.828/2014/xv6/xv6-rev8.pdf (lapic.c)
+ */
+
+#include <common.h>
+#include <hardware/cpu/lapic.h>
+#include <hardware/pit.h>
+#include <hardware/cpu/smp.h>
+#include <tasks/schedule.h>
+#include <mem/vmm.h>
+
+#define LAPIC_ID            0x020 // register offsets
+#define LAPIC_TPR           0x080 // task priority
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0 // spurious interrupt vector
+#define LAPIC_ICR_LOW       0x300 // interrupt command
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define SVR_ENABLE         0x100   // software-enables the local APIC
+#define ICR_FIXED          0x000   // delivery modes
+#define ICR_INIT           0x500
+#define ICR_STARTUP        0x600
+#define ICR_PENDING        0x1000  // the last IPI was not delivered yet
+#define ICR_ASSERT         0x4000
+#define ICR_LEVEL          0x8000
+#define LVT_MASKED         0x10000
+#define LVT_PERIODIC       0x20000
+#define TIMER_DIVIDE_16    0x3
+#define CALIBRATION_TICKS  5       // how many PIT ticks to count LAPIC timer ticks
+
+static volatile uint32_t* lapic = 0;
+static uint32_t timer_count = 0; // LAPIC timer ticks per scheduler tick
+static uint32_t oneshot_count[SMP_MAX_CPUS] = {0}; // programmed when the tick was stopped
+static uint32_t since_tick[SMP_MAX_CPUS] = {0};    // LAPIC timer ticks since the last tick back then
+static uint32_t lag[SMP_MAX_CPUS] = {0};           // how far the tick lags behind after resuming
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / sizeof(uint32_t)];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / sizeof(uint32_t)] = value;
+}
+
+// handles timer interrupts and reschedule IPIs
+static cpu_state_t* lapic_handle_timer(cpu_state_t* cpu) {
+    lapic_send_eoi(); // acknowledge before we possibly switch tasks
+    smp_cpu_t* this_cpu = smp_get_cpu();
+    uint32_t ticks = 1;
+    if (this_cpu->tickless) {
+        ticks = lapic_timer_resume(); // the ticks we slept through
+        schedule_skip_ticks(ticks ? ticks - 1 : 0); // schedule() counts the last one
+    } else if (cpu->intr == ISR_RESCHEDULE)
+        return cpu; // we are ticking anyway
+    if (this_cpu->id == 0)
+        pit_advance_clock(ticks); // the boot CPU keeps the time
+    return schedule(cpu);
+}
+
+void lapic_init(void* paddr) {
+    lapic = vmm_map_physical_memory(paddr, 0x1000,
+            VMM_KERNEL | VMM_WRITABLE | VMM_UNCACHED);
+    lapic_enable();
+}
+
+// called on every CPU, accepts all interrupts
+void lapic_enable() {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, SVR_ENABLE | ISR_LAPIC_SPURIOUS);
+}
+
+uint8_t lapic_get_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_send_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_send_command(uint8_t lapic_id, uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, lapic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command); // writing the low word sends the IPI
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING);
+}
+
+void lapic_send_ipi(uint8_t lapic_id, uint8_t vector) {
+    lapic_send_command(lapic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+// resets a CPU, it then waits for a startup IPI
+void lapic_send_init(uint8_t lapic_id) {
+    lapic_send_command(lapic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    lapic_delay(200);
+    lapic_send_command(lapic_id, ICR_INIT | ICR_LEVEL); // deassert
+    lapic_delay(100);
+}
+
+// starts a CPU in real mode at the given page below 1MiB
+void lapic_send_startup(uint8_t lapic_id, void* entry_point) {
+    lapic_send_command(lapic_id, ICR_STARTUP | ((uintptr_t) entry_point >> 12));
+}
+
+// busy waits roughly the given number of microseconds
+void lapic_delay(uint32_t us) {
+    while (us--)
+        io_wait(); // an I/O port access takes about 1us
+}
+
+// counts how fast the LAPIC timer runs using the PIT (interrupts need to be enabled)
+void lapic_timer_init(uint32_t freq) {
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    uint32_t ticks = pit_get_ticks();
+    while (pit_get_ticks() == ticks); // start right after a PIT tick
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    ticks = pit_get_ticks();
+    while (pit_get_ticks() - ticks < CALIBRATION_TICKS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    // elapsed / CALIBRATION_TICKS is per PIT tick, we want it per 1/freq seconds
+    timer_count = elapsed / CALIBRATION_TICKS * pit_ms_to_ticks(1000) / freq;
+    isr_register_handler(ISR_LAPIC_TIMER, lapic_handle_timer);
+    isr_register_handler(ISR_RESCHEDULE, lapic_handle_timer);
+}
+
+// starts this CPU's periodic timer interrupt at the calibrated frequency
+void lapic_timer_start() {
+    lapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_PERIODIC | ISR_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL, timer_count);
+}
+
+// Stops this CPU's periodic tick. The timer fires once after the given number
+// of ticks instead (0 means no deadline, then it fires after the longest time
+// possible). Returns 0 if this CPU's tick does not come from the local APIC.
+uint8_t lapic_timer_stop(uint32_t ticks) {
+    if (!lapic || !timer_count)
+        return 0;
+    smp_cpu_t* cpu = smp_get_cpu();
+    uint32_t id = cpu->id, count = 0xFFFFFFFF;
+    // the tick's phase, so that the one-shot fires at a tick boundary
+    since_tick[id] = timer_count - lapic_read(LAPIC_TIMER_CURRENT) + lag[id];
+    if (ticks && ticks < 0xFFFFFFFF / timer_count)
+        count = ticks * timer_count > since_tick[id] ?
+                ticks * timer_count - since_tick[id] : 1;
+    lapic_write(LAPIC_LVT_TIMER, ISR_LAPIC_TIMER); // one-shot mode
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+    oneshot_count[id] = count;
+    cpu->tickless = 1;
+    return 1;
+}
+
+// Restarts this CPU's periodic tick and returns how many ticks have passed
+// since it was stopped. The part of a tick that passed before resuming is
+// remembered as lag and counted next time, so the boot CPU's clock keeps up.
+uint32_t lapic_timer_resume() {
+    smp_cpu_t* cpu = smp_get_cpu();
+    uint32_t id = cpu->id,
+            elapsed = oneshot_count[id] - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_timer_start();
+    cpu->tickless = 0;
+    uint32_t ticks = elapsed / timer_count,
+            rest = elapsed % timer_count + since_tick[id];
+    lag[id] = rest % timer_count;
+    return ticks + rest / timer_count;
+}
+
+// makes a CPU whose tick is stopped reschedule, e.g. because it has a new task
+void lapic_timer_kick(uint32_t id) {
+    smp_cpu_t* cpu = smp_get_cpu_by_id(id);
+    if (cpu->tickless)
+        lapic_send_ipi(cpu->lapic_id, ISR_RESCHEDULE);
+}
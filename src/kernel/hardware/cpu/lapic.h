@@ -0,0 +1,21 @@
+#ifndef HARDWARE_CPU_LAPIC_H
+#define HARDWARE_CPU_LAPIC_H
+
+#include <stdint.h>
+#include <interrupts/isr.h>
+
+void lapic_init(void* paddr);
+void lapic_enable();
+uint8_t lapic_get_id();
+void lapic_send_eoi();
+void lapic_send_ipi(uint8_t lapic_id, uint8_t vector);
+void lapic_send_init(uint8_t lapic_id);
+void lapic_send_startup(uint8_t lapic_id, void* entry_point);
+void lapic_delay(uint32_t us);
+void lapic_timer_init(uint32_t freq);
+void lapic_timer_start();
+uint8_t lapic_timer_stop(uint32_t ticks);
+uint32_t lapic_timer_resume();
+void lapic_timer_kick(uint32_t id);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Model Specific Registers - CPU configuration beyond the control registers
+ *
+ * MSRs are only available if CPUID reports the MSR feature. Every MSR is
+ * 64 bits wide, but the ones we use fit into 32 bits.
+ *
+ * http://wiki.osdev.org/Model_Specific_Registers
+ * http://www.felixcloutier.com/x86/WRMSR.html
+ */
+
+#ifndef HARDWARE_CPU_MSR_H
+#define HARDWARE_CPU_MSR_H
+
+#include <stdint.h>
+
+#define MSR_SYSENTER_CS  0x174 // kernel code segment for SYSENTER (SS is CS + 8)
+#define MSR_SYSENTER_ESP 0x175 // kernel stack pointer for SYSENTER
+#define MSR_SYSENTER_EIP 0x176 // kernel entry point for SYSENTER
+
+static inline uint64_t msr_read(uint32_t msr) {
+    uint64_t value;
+    asm volatile("rdmsr" : "=A" (value) : "c" (msr));
+    return value;
+}
+
+static inline void msr_write(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c" (msr), "A" (value));
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * SMP - symmetric multiprocessing
+ *
+ * The boot CPU finds the other processors (APs) in the ACPI MADT and starts
+ * them one after another with INIT-SIPI-SIPI. An AP starts in real mode in the
+ * trampoline (see smp_asm.S) which switches to protected mode, enables paging
+ * and calls smp_ap_main(). Every CPU has its own GDT, TSS and per-CPU data
+ * (smp_cpu_t) which the kernel reaches through FS. All CPUs use their local
+ * APIC timer to run the scheduler, the boot CPU's also keeps the system clock.
+ * Without a local APIC, the boot CPU keeps using the PIT (and the PIC).
+ * The CPUs share the kernel with the big kernel lock, see isr_lock_kernel().
+ *
+ * http://wiki.osdev.org/Symmetric_Multiprocessing
+ * http://www.lowlevel.eu/wiki/Symmetric_Multiprocessing
+ * http://www.intel.com/design/pentium/datashts/24201606.pdf (MP specification, B.4)
+ * https://pdos.csail.mit.edu/6.828/2014/xv6/xv6-rev8.pdf (main.c, entryother.S)
+ */
+
+#include <common.h>
+#include <hardware/cpu/smp.h>
+#include <hardware/cpu/lapic.h>
+#include <hardware/cpu/cpuid.h>
+#include <hardware/cpu/fpu.h>
+#include <hardware/acpi.h>
+#include <hardware/ioapic.h>
+#include <hardware/pit.h>
+#include <interrupts/idt.h>
+#include <interrupts/isr.h>
+#include <interrupts/pic.h>
+#include <tasks/schedule.h>
+#include <mem/gdt.h>
+#include <mem/vmm.h>
+#include <string.h>
+
+#define TRAMPOLINE_ADDRESS ((void*) 0x8000) // page below 1MiB, keep in sync with smp_asm.S
+#define STARTUP_DELAY      200    // microseconds between the startup IPIs
+#define STARTUP_TIMEOUT    100000 // microseconds to wait for an AP
+
+// The boot CPU is running already. It starts with interrupts disabled, so it
+// holds the kernel lock.
+static smp_cpu_t cpus[SMP_MAX_CPUS] =
+        {{.self = &cpus[0], .id = 0, .started = 1, .lock_depth = 1}};
+static uint32_t cpu_number = 1;
+
+extern uint8_t smp_trampoline_start[], smp_trampoline_end[]; // see smp_asm.S
+void* smp_ap_page_directory; // read by smp_asm.S, the kernel page directory
+void* smp_ap_stack;          // read by smp_asm.S, top of the starting AP's stack
+static smp_cpu_t* ap_cpu;    // the AP that is starting, APs start one at a time
+
+smp_cpu_t* smp_get_cpu_by_id(uint32_t id) {
+    return cpus + id;
+}
+
+uint32_t smp_get_cpu_number() {
+    return cpu_number;
+}
+
+// called by the trampoline with interrupts disabled
+void smp_ap_main() {
+    smp_cpu_t* cpu = ap_cpu;
+    gdt_init_cpu(cpu->id); // from now on smp_get_cpu() works
+    idt_init_cpu();
+    isr_init_sysenter();
+    isr_lock_kernel(); // interrupts are disabled, so we need the kernel lock
+    fpu_init_cpu();
+    lapic_enable();
+    schedule_init_cpu();
+    lapic_timer_start();
+    cpu->started = 1;
+    isr_enable_interrupts(1);
+    while (1) // wait until the scheduler switches to a task, this
+        asm volatile("hlt"); // stack is not used afterwards
+}
+
+static uint8_t smp_start_cpu(uint8_t lapic_id) {
+    smp_cpu_t* cpu = cpus + cpu_number;
+    cpu->self = cpu;
+    cpu->id = cpu_number;
+    cpu->lapic_id = lapic_id;
+    cpu->page_directory = smp_ap_page_directory; // loaded by the trampoline
+    ap_cpu = cpu;
+    smp_ap_stack = (uint8_t*) vmm_alloc(_4KB, VMM_KERNEL) + _4KB;
+    lapic_send_init(lapic_id);
+    lapic_delay(10000);
+    for (int i = 0; i < 2 && !cpu->started; i++) { // the second startup IPI is
+        lapic_send_startup(lapic_id, TRAMPOLINE_ADDRESS); // recommended by Intel
+        lapic_delay(STARTUP_DELAY);
+    }
+    for (int i = 0; i < STARTUP_TIMEOUT && !cpu->started; i++)
+        lapic_delay(1);
+    if (!cpu->started) {
+        println("%4aCPU with local APIC %d did not start%a", lapic_id);
+        return 0;
+    }
+    cpu_number++;
+    return 1;
+}
+
+// starts all other CPUs, interrupts need to be enabled (for calibrating the timer)
+void smp_init() {
+    if (!cpuid_get_features()->apic || !acpi_init())
+        return; // we just keep running on the boot CPU
+    acpi_madt_t* madt = acpi_get_madt();
+    lapic_init(madt->lapic_address);
+    cpus[0].lapic_id = lapic_get_id();
+    lapic_timer_init(pit_ms_to_ticks(1000)); // tick as fast as the PIT
+    lapic_timer_start(); // the boot CPU's local APIC timer takes over the
+    pic_mask_irq(0, 1); // ticks from the PIT
+    ioapic_init(); // deliver IRQs through the I/O APIC instead of the PIC
+    print("SMP init ... ");
+    size_t trampoline_len = smp_trampoline_end - smp_trampoline_start;
+    void* trampoline = vmm_map_physical_memory(TRAMPOLINE_ADDRESS,
+            trampoline_len, VMM_KERNEL | VMM_WRITABLE);
+    memcpy(trampoline, smp_trampoline_start, trampoline_len);
+    vmm_unmap_physical_memory(trampoline, trampoline_len);
+    smp_ap_page_directory = vmm_get_kernel_page_directory();
+    for (int i = 0; i < madt->processors && cpu_number < SMP_MAX_CPUS; i++)
+        if (madt->lapic_ids[i] != cpus[0].lapic_id)
+            smp_start_cpu(madt->lapic_ids[i]);
+    println("%2aok%a. %d CPU%s running.", cpu_number, cpu_number == 1 ? "" : "s");
+}
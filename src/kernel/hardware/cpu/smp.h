@@ -0,0 +1,34 @@
+#ifndef HARDWARE_CPU_SMP_H
+#define HARDWARE_CPU_SMP_H
+
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 16
+
+typedef struct smp_cpu {
+    struct smp_cpu* self;  // must come first, see smp_get_cpu()
+    uint32_t id;           // index into the CPU table, the boot CPU is 0
+    uint8_t lapic_id;      // used to send IPIs to this CPU
+    volatile uint8_t started; // set by the CPU when it is ready to run tasks
+    uint32_t lock_depth;   // how often this CPU took the kernel lock, see isr_lock_kernel()
+    uint32_t current_task; // the task running on this CPU
+    uint32_t idle_task;    // runs when this CPU has nothing else to do
+    uint32_t fpu_owner;    // whose state lies in this CPU's FPU registers
+    void* page_directory;  // physical address of the loaded page directory
+    volatile uint8_t tickless; // whether this CPU's tick is stopped, see lapic_timer_stop()
+    uint64_t irqs_off_tsc; // when interrupts were last disabled, see isr_enable_interrupts()
+} smp_cpu_t; // per-CPU data
+
+// In the kernel, FS always holds GDT_CPU_SEG whose base is the current CPU's
+// smp_cpu_t, so finding it takes one FS-prefixed load.
+static inline smp_cpu_t* smp_get_cpu() {
+    smp_cpu_t* cpu;
+    asm volatile("mov %%fs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+smp_cpu_t* smp_get_cpu_by_id(uint32_t id);
+uint32_t smp_get_cpu_number();
+void smp_init();
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Time Stamp Counter - a high-resolution monotonic clock
+ *
+ * At boot, we count how many cycles pass while the PIT (whose frequency is
+ * known) waits for a few milliseconds. Afterwards, cycles are converted to
+ * nanoseconds with a multiplication and a shift, so reading the clock needs
+ * neither a division nor an interrupt. We assume the CPUs' TSCs run in sync
+ * (they are reset together) and at a constant rate.
+ *
+ * http://wiki.osdev.org/TSC
+ * https://lwn.net/Articles/209101/ (clocksources)
+ */
+
+#include <common.h>
+#include <hardware/cpu/tsc.h>
+#include <hardware/pit.h>
+
+#define CALIBRATE_MS   10 // how long one calibration run takes
+#define CALIBRATE_RUNS 3  // we take the shortest run, the others might be disturbed
+#define SHIFT          24 // ns = cycles * mult >> SHIFT, works for TSCs faster than 4MHz
+
+static uint32_t khz = 0; // TSC frequency, 0 if not calibrated
+static uint32_t mult = 0; // nanoseconds per cycle << SHIFT
+static uint64_t boot_tsc = 0; // the clock counts from here
+
+// divides without libgcc's 64-bit division, the remainder may be 0
+uint64_t tsc_divide(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = dividend >> 32, low = dividend, quotient_high = high / divisor,
+            quotient_low, rest = high % divisor; // rest < divisor, so the 2nd divl can't overflow
+    asm("divl %4" : "=a" (quotient_low), "=d" (rest) : "a" (low), "d" (rest), "rm" (divisor));
+    if (remainder)
+        *remainder = rest;
+    return (uint64_t) quotient_high << 32 | quotient_low;
+}
+
+void tsc_init() {
+    print("TSC init ... ");
+    uint64_t cycles = -1;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t start = tsc_read();
+        pit_delay(CALIBRATE_MS);
+        uint64_t run = tsc_read() - start;
+        if (run < cycles)
+            cycles = run;
+    }
+    khz = tsc_divide(cycles, CALIBRATE_MS, 0);
+    if (khz < 4000) { // too slow for SHIFT (or no TSC at all)
+        khz = 0;
+        println("%4afail%a.");
+        return;
+    }
+    mult = tsc_divide(1000000ULL << SHIFT, khz, 0); // ns per cycle = 10^6 / kHz
+    boot_tsc = tsc_read();
+    println("%2aok%a. %d MHz.", khz / 1000);
+}
+
+// returns the TSC frequency in kHz or 0 if the TSC is not calibrated
+uint32_t tsc_get_khz() {
+    return khz;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles) {
+    // (high * 2^32 + low) * mult >> SHIFT, without losing the high bits of low * mult
+    uint64_t low = (uint64_t) (uint32_t) cycles * mult, high = (uint64_t) (uint32_t) (cycles >> 32) * mult;
+    return (high << (32 - SHIFT)) + (low >> SHIFT);
+}
+
+// nanoseconds since boot, 0 if the TSC is not calibrated
+uint64_t tsc_get_ns() {
+    return khz ? tsc_to_ns(tsc_read() - boot_tsc) : 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Time Stamp Counter - counts CPU cycles since reset
+ *
+ * Every Pentium has a TSC, so we don't check CPUID before reading it.
+ * Note that the cycle rate may change with power management on newer CPUs.
+ * Calibrated against the PIT, the TSC is our high-resolution clock.
+ *
+ * http://wiki.osdev.org/TSC
+ * http://www.felixcloutier.com/x86/RDTSC.html
+ */
+
+#ifndef HARDWARE_CPU_TSC_H
+#define HARDWARE_CPU_TSC_H
+
+#include <stdint.h>
+
+static inline uint64_t tsc_read() {
+    uint64_t tsc;
+    asm volatile("rdtsc" : "=A" (tsc)); // "=A" means EDX:EAX
+    return tsc;
+}
+
+void tsc_init();
+uint32_t tsc_get_khz();
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t tsc_get_ns();
+uint64_t tsc_divide(uint64_t dividend, uint32_t divisor, uint32_t* remainder);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Input - buffers keyboard and mouse events for user tasks
+ *
+ * The PS/2 drivers push events into a ring buffer (from deferred work). Tasks
+ * waiting for input are blocked on a wait queue and every new event wakes
+ * exactly one of them. If nobody reads the events, the oldest ones are
+ * overwritten.
+ *
+ * http://wiki.osdev.org/Blocking_Process
+ */
+
+#include <common.h>
+#include <hardware/io/input.h>
+#include <tasks/wait.h>
+
+#define INPUT_BUFFER_SIZE 64 // must be a power of two
+
+static input_event_t buffer[INPUT_BUFFER_SIZE]; // events not read yet
+static uint32_t read_pos = 0, write_pos = 0; // free running, wrap via masking
+static wait_queue_t waiting = {0}; // tasks blocked in input_wait
+
+static void input_push(input_event_t* event) {
+    uint8_t old_interrupts = isr_enable_interrupts(0);
+    if (write_pos - read_pos == INPUT_BUFFER_SIZE)
+        read_pos++; // buffer full, drop the oldest event
+    buffer[write_pos++ % INPUT_BUFFER_SIZE] = *event;
+    wait_wake_one(&waiting);
+    isr_enable_interrupts(old_interrupts);
+}
+
+void input_push_keyboard(keyboard_event_t e) {
+    input_event_t event = {
+        .type = INPUT_KEYBOARD, .keycode = e.keycode, .pressed = e.pressed, .ascii = e.ascii,
+        .flags = (e.flags.shift ? INPUT_SHIFT : 0) | (e.flags.ctrl ? INPUT_CTRL : 0) |
+            (e.flags.gui ? INPUT_GUI : 0) | (e.flags.alt ? INPUT_ALT : 0) |
+            (e.flags.scroll_lock ? INPUT_SCROLL_LOCK : 0) |
+            (e.flags.num_lock ? INPUT_NUM_LOCK : 0) | (e.flags.caps_lock ? INPUT_CAPS_LOCK : 0)
+    };
+    input_push(&event);
+}
+
+void input_push_mouse(mouse_event_t e) {
+    input_event_t event = {
+        .type = INPUT_MOUSE, .x = e.x, .y = e.y, .screen_x = e.screen_x, .screen_y = e.screen_y,
+        .buttons = (e.left ? INPUT_LEFT : 0) | (e.right ? INPUT_RIGHT : 0) |
+            (e.middle ? INPUT_MIDDLE : 0)
+    };
+    input_push(&event);
+}
+
+// takes the oldest event from the buffer, returns 0 if there is none
+uint8_t input_read(input_event_t* event) {
+    uint8_t old_interrupts = isr_enable_interrupts(0), read = 0;
+    if (read_pos != write_pos) {
+        *event = buffer[read_pos++ % INPUT_BUFFER_SIZE];
+        read = 1;
+    }
+    isr_enable_interrupts(old_interrupts);
+    return read;
+}
+
+// blocks the current task until the next event arrives (called from a syscall)
+cpu_state_t* input_wait(cpu_state_t* cpu) {
+    return wait_sleep(&waiting, cpu);
+}
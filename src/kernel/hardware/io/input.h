@@ -0,0 +1,13 @@
+#ifndef HARDWARE_IO_INPUT_H
+#define HARDWARE_IO_INPUT_H
+
+#include <hardware/io/keyboard.h>
+#include <hardware/io/mouse.h>
+#include <input.h>
+
+void input_push_keyboard(keyboard_event_t event);
+void input_push_mouse(mouse_event_t event);
+uint8_t input_read(input_event_t* event);
+cpu_state_t* input_wait(cpu_state_t* cpu);
+
+#endif
@@ -11,6 +11,7 @@
 #include <common.h>
 #include <string.h>
 #include <hardware/io/keyboard.h>
+#include <hardware/io/input.h>
 
 // keyboard commands
 #define SET_LEDS             0xED
@@ -266,6 +267,7 @@ static void keyboard_process_scancode(uint8_t is_makecode) {
             keyboard_leds(CAPS,   event.flags.caps_lock   = !event.flags.caps_lock);
     }
     
+    input_push_keyboard(event); // pass the event on to user tasks
     if (handler) handler(event); // call our event handler if there is one
     
     keyboard_state = START; // reset the state machine so
@@ -291,8 +293,8 @@ void keyboard_register_handler(keyboard_handler_t _handler) {
     handler = _handler;
 }
 
-// called by the PS/2 driver with a scancode byte
-void keyboard_handle_data(uint8_t data) {   
+// called by the PS/2 driver (deferred, with interrupts enabled) with a scancode byte
+void keyboard_handle_data(uint32_t data) {   
     if (keyboard_state == BREAK_RECEIVED) // ignore the BREAK_CODE byte
         scancode_len--; // so we can easily convert breakcodes to keycodes
     scancode_buf[scancode_len++] = data; // save scancode byte
@@ -25,6 +25,6 @@ uint8_t keyboard_get_keycode(char* name);
 uint8_t keyboard_get_key_pressed(uint8_t keycode);
 keyboard_event_t keyboard_get_event();
 void keyboard_register_handler(keyboard_handler_t _handler);
-void keyboard_handle_data(uint8_t data);
+void keyboard_handle_data(uint32_t data);
 
 #endif
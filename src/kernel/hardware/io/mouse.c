@@ -8,6 +8,7 @@
 
 #include <common.h>
 #include <hardware/io/mouse.h>
+#include <hardware/io/input.h>
 
 // mouse commands
 #define GET_STATUS      0xE9
@@ -115,10 +116,12 @@ static void mouse_process_packet(mouse_packet_t* packet) {
     event.left   = packet->left;
     event.right  = packet->right;
     event.middle = packet->middle;
+    input_push_mouse(event); // pass the event on to user tasks
     if (handler) handler(event); // call our event handler if there is one
 }
 
-void mouse_handle_data(uint8_t data) {
+// called by the PS/2 driver (deferred, with interrupts enabled) with a packet byte
+void mouse_handle_data(uint32_t data) {
     packet_buf[packet_len++] = data; // save packet byte
         
     if (packet_len == 1 && !(data & FLAG_ALWAYS_ONE)) // if the "always one"
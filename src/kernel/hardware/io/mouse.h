@@ -13,6 +13,6 @@ typedef void (*mouse_handler_t)(mouse_event_t event);
 
 void mouse_init(ps2_port_t _port);
 void mouse_register_handler(mouse_handler_t _handler);
-void mouse_handle_data(uint8_t data);
+void mouse_handle_data(uint32_t data);
 
 #endif
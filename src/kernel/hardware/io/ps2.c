@@ -9,8 +9,10 @@
 #include <common.h>
 #include <hardware/io/ps2.h>
 #include <hardware/pit.h>
+#include <tasks/timer.h>
 #include <hardware/io/keyboard.h>
 #include <hardware/io/mouse.h>
+#include <interrupts/deferred.h>
 
 // the controller's I/O ports
 #define PS2_DATA           0x60 // write device commands, read device/PS/2 results
@@ -76,10 +78,24 @@ typedef union {
     uint8_t byte;
 } ps2_output_port_t;
 
+typedef struct {
+    timer_t timer;
+    volatile uint8_t expired; // set by the timer wheel after PS2_TIMEOUT ms
+} ps2_timeout_t;
+
 static uint8_t init_done = 0;
 static uint8_t port2_supported = 1; // let's assume that port 2 (IRQ12) is supported
 static ps2_error_t err = 0; // timeout error (we often ignore this)
 
+static void ps2_expire(void* data) {
+    ((ps2_timeout_t*) data)->expired = 1;
+}
+
+static inline void ps2_start_timeout(ps2_timeout_t* timeout) {
+    timeout->expired = 0;
+    timer_add(&timeout->timer, pit_ms_to_ticks(PS2_TIMEOUT), ps2_expire, timeout);
+}
+
 static inline uint8_t ps2_ready() {
     return !((ps2_status_t) inb(PS2_CMD)).bits.inbuf_full;
 }
@@ -96,10 +112,12 @@ static inline int8_t ps2_available(ps2_port_t port) {
 }
 
 static inline uint8_t ps2_write(uint8_t io_port, uint8_t command) {
-    pit_timeout_t timeout = pit_make_timeout(PS2_TIMEOUT);
+    ps2_timeout_t timeout;
+    ps2_start_timeout(&timeout);
     // wait until PS/2 controller accepts input or a timeout occurs
-    while (!ps2_ready() && !pit_timed_out(&timeout));
-    if (pit_timed_out(&timeout)) {
+    while (!ps2_ready() && !timeout.expired);
+    timer_cancel(&timeout.timer);
+    if (!ps2_ready()) { // the timer might have fired right after the controller got ready
         println("%4aPS/2 write timeout (%02x,%02x)%a", io_port, command);
         return 0;
     }
@@ -108,10 +126,12 @@ static inline uint8_t ps2_write(uint8_t io_port, uint8_t command) {
 }
 
 static inline uint8_t ps2_read(ps2_port_t port, ps2_error_t* err) {
-    pit_timeout_t timeout = pit_make_timeout(PS2_TIMEOUT);
+    ps2_timeout_t timeout;
+    ps2_start_timeout(&timeout);
     // wait until PS/2 controller holds data for port or a timeout occurs
-    while (!ps2_available(port) && !pit_timed_out(&timeout));
-    if (pit_timed_out(&timeout)) {
+    while (!ps2_available(port) && !timeout.expired);
+    timer_cancel(&timeout.timer);
+    if (!ps2_available(port)) {
         println("%4aPS/2 port %d read timeout%a", port);
         *err = PS2_TIMEOUT_ERR;
         return 0;
@@ -175,9 +195,12 @@ uint8_t ps2_read_device(ps2_port_t port, ps2_error_t* err) {
 
 static uint8_t ps2_reset_device(ps2_port_t port) {
     ps2_write_device_no_ack(port, DEVICE_RESET);
-    pit_timeout_t timeout = pit_make_timeout(PS2_TIMEOUT);
-    while (ps2_read_device(port, &err) != DEVICE_TEST_PASSED && !pit_timed_out(&timeout));
-    if (pit_timed_out(&timeout)) {
+    ps2_timeout_t timeout;
+    uint8_t passed = 0;
+    ps2_start_timeout(&timeout);
+    while (!(passed = ps2_read_device(port, &err) == DEVICE_TEST_PASSED) && !timeout.expired);
+    timer_cancel(&timeout.timer);
+    if (!passed) {
         print("%4afail%a. Port %d reset failed. ", port);
         return 0;
     } else return 1;
@@ -240,13 +263,11 @@ static cpu_state_t* ps2_handle_interrupt(cpu_state_t* cpu) {
         println("%4aIRQ12: not a PS/2 device%a");
         return cpu;
     }
-    uint8_t data = inb(PS2_DATA);
+    uint8_t data = inb(PS2_DATA); // reading the byte acknowledges it
     if (data == DEVICE_ACK) // ignore when we send commands to
         return cpu; // the device while scanning is enabled
-    if (cpu->intr == ISR_IRQ(1))
-        keyboard_handle_data(data);
-    else if (cpu->intr == ISR_IRQ(12))
-        mouse_handle_data(data);
+    // decoding and the event handlers run later with interrupts enabled
+    deferred_queue(cpu->intr == ISR_IRQ(1) ? keyboard_handle_data : mouse_handle_data, data);
     return cpu;
 }
 
@@ -8,12 +8,16 @@
 #include <common.h>
 #include <hardware/io/speaker.h>
 #include <hardware/pit.h>
+#include <tasks/task.h>
+#include <tasks/timer.h>
 
 #define PIT_SPEAKER      0x61
 #define MODE_SQUARE_WAVE 0x03
 #define SPEAKER_ON       0x01
 #define SPEAKER_CHANNEL2 0x02
 
+static timer_t tone_timer; // turns the speaker off when a tone ends
+
 void speaker_on(uint32_t freq) {
     if (!pit_init_channel(2, MODE_SQUARE_WAVE, freq)) {
         println("%4aSpeaker frequency must be > 18Hz and < 0.59MHz%a");
@@ -28,29 +32,23 @@ void speaker_off() {
     outb(PIT_SPEAKER, state & ~(SPEAKER_ON | SPEAKER_CHANNEL2));
 }
 
+static void speaker_handle_tone_end(void* data) {
+    speaker_off();
+}
+
+// plays a tone without waiting for it, the timer wheel turns the speaker off again
+// (a new tone cuts the last one short)
 void speaker_play(uint32_t freq, uint32_t ms) {
-    print("speaker on %d Hz, waiting %d ms, ", freq, ms);
+    timer_cancel(&tone_timer);
     speaker_on(freq);
-    pit_sleep(ms);
-    speaker_off();
-    println("speaker off");
+    timer_add(&tone_timer, pit_ms_to_ticks(ms), speaker_handle_tone_end, 0);
 }
 
 void speaker_test() {
-    while (1) {
-        speaker_play(523, 200);
-        speaker_play(587, 200);
-        speaker_play(659, 200);
-        speaker_play(698, 200);
-        speaker_play(784, 200);
-        speaker_play(880, 200);
-        speaker_play(988, 200);
-        speaker_play(1047, 200);
-        speaker_play(988, 200);
-        speaker_play(880, 200);
-        speaker_play(784, 200);
-        speaker_play(698, 200);
-        speaker_play(659, 200);
-        speaker_play(587, 200);
-    }
-}
\ No newline at end of file
+    uint32_t notes[] = {523, 587, 659, 698, 784, 880, 988, 1047, 988, 880, 784, 698, 659, 587};
+    while (1)
+        for (uint32_t i = 0; i < sizeof(notes) / sizeof(*notes); i++) {
+            speaker_play(notes[i], 200);
+            task_sleep(200); // the tone ends by itself, we only wait for the next note
+        }
+}
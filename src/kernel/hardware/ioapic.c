@@ -0,0 +1,117 @@
+/*
+ * I/O APIC - routes device interrupts to the CPUs' local APICs
+ *
+ * If there is an I/O APIC, it replaces the 8259 PICs. Every ISA IRQ is wired
+ * to one of its inputs (usually the one with the same number, the MADT lists
+ * the exceptions) and can be delivered to any CPU. IRQs keep their vectors
+ * (ISR_IRQ), but they are acknowledged with a single write to the local APIC
+ * instead of port I/O to the PIC, see isr_handle_interrupt(). All IRQs go to
+ * the boot CPU until ioapic_set_affinity() (or sys_irqaffinity from user
+ * space) routes them elsewhere.
+ *
+ * http://wiki.osdev.org/IOAPIC
+ * http://www.lowlevel.eu/wiki/APIC
+ * https://pdos.csail.mit.edu/6.828/2014/xv6/xv6-rev8.pdf (ioapic.c)
+ */
+
+#include <common.h>
+#include <hardware/ioapic.h>
+#include <hardware/acpi.h>
+#include <hardware/cpu/smp.h>
+#include <interrupts/isr.h>
+#include <interrupts/pic.h>
+#include <lib/spinlock.h>
+#include <mem/vmm.h>
+
+#define IOREGSEL           0x00 // register offsets, we select a register
+#define IOWIN              0x10 // and then access it through the window
+#define IOAPIC_VERSION     0x01 // bits 16-23: number of inputs - 1
+#define IOAPIC_REDTBL(n)   (0x10 + 2 * (n)) // redirection entry of input n (low word)
+#define REDTBL_ACTIVE_LOW  0x2000
+#define REDTBL_LEVEL       0x8000 // level-triggered instead of edge-triggered
+#define REDTBL_MASKED      0x10000
+#define INTI_ACTIVE_LOW    0x3 // polarity and trigger mode in the MADT's flags
+#define INTI_LEVEL         0xC
+#define IRQ_CASCADE        2   // connects the PICs, never fires
+
+static volatile uint32_t* ioapic = 0;
+static uint32_t inputs = 0; // number of redirection entries
+static spinlock_t lock = SPINLOCK_INIT("I/O APIC"); // for IOREGSEL and IOWIN
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOREGSEL / sizeof(uint32_t)] = reg;
+    return ioapic[IOWIN / sizeof(uint32_t)];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    ioapic[IOREGSEL / sizeof(uint32_t)] = reg;
+    ioapic[IOWIN / sizeof(uint32_t)] = value;
+}
+
+// returns the input an ISA IRQ is wired to or -1 if it is not ours
+static uint32_t ioapic_get_input(uint8_t irq) {
+    if (irq >= ACPI_ISA_IRQS || irq == IRQ_CASCADE)
+        return -1;
+    acpi_madt_t* madt = acpi_get_madt();
+    uint32_t input = madt->irq_gsi[irq] - madt->ioapic_gsi_base;
+    return input < inputs ? input : -1;
+}
+
+// whether IRQs are delivered by the I/O APIC (otherwise by the PIC)
+uint8_t ioapic_get_enabled() {
+    return ioapic != 0;
+}
+
+// delivers an IRQ to the given CPU from now on, returns 0 if the IRQ is invalid
+// or the CPU does not exist or is not running (it would never handle the IRQ)
+uint8_t ioapic_set_affinity(uint8_t irq, uint32_t cpu) {
+    uint32_t input;
+    if (!ioapic || cpu >= smp_get_cpu_number() || !smp_get_cpu_by_id(cpu)->started ||
+            (input = ioapic_get_input(irq)) == -1)
+        return 0;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    ioapic_write(IOAPIC_REDTBL(input) + 1, smp_get_cpu_by_id(cpu)->lapic_id << 24);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return 1;
+}
+
+void ioapic_mask_irq(uint8_t irq, uint8_t masked) {
+    uint32_t input;
+    if (!ioapic || (input = ioapic_get_input(irq)) == -1)
+        return;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    uint32_t entry = ioapic_read(IOAPIC_REDTBL(input));
+    ioapic_write(IOAPIC_REDTBL(input),
+            masked ? entry | REDTBL_MASKED : entry & ~REDTBL_MASKED);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+}
+
+// routes the ISA IRQs to the boot CPU and disables the PIC, needs the MADT
+// and the boot CPU's local APIC ID
+uint8_t ioapic_init() {
+    acpi_madt_t* madt = acpi_get_madt();
+    if (!madt->ioapic_address)
+        return 0; // we keep using the PIC
+    print("I/O APIC init ... ");
+    ioapic = vmm_map_physical_memory(madt->ioapic_address, 0x1000,
+            VMM_KERNEL | VMM_WRITABLE | VMM_UNCACHED);
+    inputs = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    for (uint32_t i = 0; i < inputs; i++) // mask everything we don't route
+        ioapic_write(IOAPIC_REDTBL(i), REDTBL_MASKED);
+    uint16_t pic_mask = pic_disable();
+    for (uint8_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        uint32_t input = ioapic_get_input(irq), entry = ISR_IRQ(irq);
+        if (input == -1)
+            continue;
+        if ((madt->irq_flags[irq] & INTI_ACTIVE_LOW) == INTI_ACTIVE_LOW)
+            entry |= REDTBL_ACTIVE_LOW;
+        if ((madt->irq_flags[irq] & INTI_LEVEL) == INTI_LEVEL)
+            entry |= REDTBL_LEVEL;
+        if ((pic_mask >> irq) & 1) // IRQs masked at the PIC (e.g. the PIT's)
+            entry |= REDTBL_MASKED; // stay masked
+        ioapic_write(IOAPIC_REDTBL(input) + 1, smp_get_cpu_by_id(0)->lapic_id << 24);
+        ioapic_write(IOAPIC_REDTBL(input), entry); // fixed delivery, physical destination
+    }
+    println("%2aok%a. %d inputs.", inputs);
+    return 1;
+}
@@ -0,0 +1,11 @@
+#ifndef HARDWARE_IOAPIC_H
+#define HARDWARE_IOAPIC_H
+
+#include <stdint.h>
+
+uint8_t ioapic_init();
+uint8_t ioapic_get_enabled();
+uint8_t ioapic_set_affinity(uint8_t irq, uint32_t cpu);
+void ioapic_mask_irq(uint8_t irq, uint8_t masked);
+
+#endif
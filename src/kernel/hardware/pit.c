@@ -1,6 +1,10 @@
 /*
  * Programmable Interval Timer (IRQ0) - used for multitasking and system clock
  *
+ * The PIT defines the tick length and keeps the system clock. With a local
+ * APIC, the boot CPU's local APIC timer takes over the ticks and IRQ0 is
+ * masked (see smp_init), the PIT is only the fallback then.
+ *
  * http://lowlevel.eu/wiki/PIT
  * http://wiki.osdev.org/PIT
  * http://stackoverflow.com/questions/7083482/how-to-prevent-gcc-from-optimizing-out-a-busy-wait-loop
@@ -10,12 +14,15 @@
 #include <common.h>
 #include <hardware/pit.h>
 #include <tasks/schedule.h>
+#include <tasks/timer.h>
+#include <hardware/cpu/tsc.h>
 
 #define PIT_CHANNEL(c)   (0x40 + (c))
 #define PIT_INIT         0x43
 #define PIT_FREQ         1193182
+#define PIT_GATE         0x61 // bit 0 gates channel 2, bit 1 connects it to the speaker, bit 5 is its output
+#define MODE_ONESHOT     0x00 // interrupt on terminal count, sets channel 2's output when done
 #define MODE_RATE        0x02
-#define MS_TO_TICKS(ms, freq) ((freq) * (ms) / 1000) // freq = ticks/1s = ticks/1000ms, so ticks = freq*1000ms
 
 typedef struct {
     uint8_t fmt  : 1; // counter format (binary/bcd)
@@ -26,6 +33,8 @@ typedef struct {
 
 static uint32_t freq = 0; // assume undefined frequency in the beginning (actually, this is 18.2065Hz)
 static uint32_t seconds = 0, minutes = 0, hours = 0, ticks = 0;
+static uint32_t second_ticks = 0; // ticks since the last full second
+static uint64_t tick_tsc = 0; // when the clock was last advanced, 0 if the TSC is not calibrated yet
 
 uint8_t pit_init_channel(uint8_t channel, uint8_t mode, uint32_t freq) {
     if (freq < 19 || freq > PIT_FREQ / 2)
@@ -45,9 +54,14 @@ uint8_t pit_init_channel(uint8_t channel, uint8_t mode, uint32_t freq) {
     return 1;
 }
 
-static cpu_state_t* pit_handle_interrupt(cpu_state_t* cpu) {
-    ticks++;
-    if (ticks % freq == 0) { // every "freq" ticks a second is gone (because 1Hz = 1/s)
+// advances the system clock by some ticks (more than one if the boot CPU's
+// tick was stopped, see lapic_timer_stop) and fires due timers
+void pit_advance_clock(uint32_t elapsed) {
+    ticks += elapsed;
+    tick_tsc = tsc_get_khz() ? tsc_read() : 0; // after the ticks, see pit_get_current_ticks
+    second_ticks += elapsed;
+    while (freq && second_ticks >= freq) { // every "freq" ticks a second is gone (because 1Hz = 1/s)
+        second_ticks -= freq;
         seconds++;
         if (seconds % 60 == 0) {
             seconds = 0;
@@ -58,6 +72,11 @@ static cpu_state_t* pit_handle_interrupt(cpu_state_t* cpu) {
             }
         }
     }
+    timer_handle_tick(ticks); // wake up sleeping tasks before scheduling
+}
+
+static cpu_state_t* pit_handle_interrupt(cpu_state_t* cpu) {
+    pit_advance_clock(1);
     cpu = schedule(cpu); // returns a new stack pointer if a task change is due
     return cpu;
 }
@@ -72,46 +91,60 @@ void pit_init(uint32_t new_freq) {
         println("%4afail%a. Frequency must be > 18Hz and < 0.59MHz.");
 }
 
-void pit_dump_time() {
-    print("%02d:%02d:%02d", hours, minutes, seconds);
+uint32_t pit_get_ticks() {
+    return ticks;
 }
 
-// we disable GCC's optimization here to prevent the idling loop from being optimized away
-__attribute__((optimize("O0"))) void pit_sleep(uint32_t ms) {
-    uint32_t wait_until = ticks + MS_TO_TICKS(ms, freq); // If wait_until has overflowed, we
-    while (wait_until < ticks); // wait until ticks overflows, then it approaches
-    while (ticks < wait_until); // wait_until from the "bottom" as expected.
-    // (I used != before but when using timeouts and not an idling loop, the
-    // wait_until moment can easily be missed when doing "heavier" tasks like I/O
-    // polling. > and < are more robust in that regard.)
-    // Alternative implementation with timeouts from below:
-    // pit_timeout_t timeout = pit_make_timeout(ms); // This implementation works,
-    // while (!pit_timed_out(&timeout)); // but is slower and not as straightforward.
+// Like pit_get_ticks, but also counts the ticks that passed since the clock was last advanced. While the boot
+// CPU's tick is stopped, the clock lags behind by up to the whole time it sleeps, so use this to compute deadlines
+// from other CPUs. Rounds down like the tick does.
+uint32_t pit_get_current_ticks() {
+    uint32_t now;
+    uint64_t since;
+    do { // The clock might advance meanwhile. If we see the new ticks with the old TSC value, we are late, not early.
+        since = *(volatile uint64_t*) &tick_tsc;
+        now = *(volatile uint32_t*) &ticks;
+    } while (since != *(volatile uint64_t*) &tick_tsc);
+    if (!since || !freq)
+        return now;
+    uint32_t ms = tsc_divide(tsc_read() - since, tsc_get_khz(), 0); // fits, the boot CPU sleeps for seconds at most
+    return now + ms / 1000 * freq + ms % 1000 * freq / 1000;
 }
 
-pit_timeout_t pit_make_timeout(uint32_t ms) { // timeout constructor
-    pit_timeout_t timeout = { // avoid ticks + INT_MAX, this overflows to ticks + 0,
-        .wait_until = ticks + MS_TO_TICKS(ms, freq), // waiting NOT AT ALL.
-        .state = PIT_WAITING_UNTIL_OVERFLOW // We start by waiting until ticks overflows.
-    };
-    return timeout;
+uint32_t pit_ms_to_ticks(uint32_t ms) { // rounds up so we never wake up too early, e.g. 1ms at 50Hz
+    return ms / 1000 * freq + (ms % 1000 * freq + 999) / 1000; // is 1 tick and not 0, freq * ms might overflow
 }
 
-int8_t pit_timed_out(pit_timeout_t* timeout) {   
-    switch (timeout->state) { // simple state machine mimicking pit_sleep's
-        case PIT_WAITING_UNTIL_OVERFLOW: // behaviour in a more "asynchronous" style
-            if (!(timeout->wait_until < ticks)) // like pit_sleep's 1st while
-                timeout->state = PIT_WAITING_UNTIL_TIMEOUT;
-            return 0;
-        case PIT_WAITING_UNTIL_TIMEOUT:
-            if (!(ticks < timeout->wait_until)) { // like pit_sleep's 2nd while
-                timeout->state = PIT_TIMED_OUT;
-                return 1;
-            }
-            return 0;
-        case PIT_TIMED_OUT:
-            return 1;
-        default:
-            return -1;
+// Busy waits for up to 54 ms by polling channel 2, so this works with interrupts disabled (used to calibrate
+// the TSC). The speaker stays off.
+void pit_delay(uint32_t ms) {
+    if (ms > 54) // the counter has 16 bits
+        ms = 54;
+    uint8_t gate = inb(PIT_GATE);
+    outb(PIT_GATE, (gate & ~0x02) | 0x01); // gate on, speaker off
+    uint16_t counter = PIT_FREQ * ms / 1000;
+    pit_init_t init = {.fmt = 0, .mode = MODE_ONESHOT, .byte = 3, .chan = 2};
+    outb(PIT_INIT, *(uint8_t*) &init);
+    outb(PIT_CHANNEL(2), counter & 0xFF);
+    outb(PIT_CHANNEL(2), counter >> 8); // counting starts now
+    while (!(inb(PIT_GATE) & 0x20));
+    outb(PIT_GATE, gate);
+}
+
+void pit_dump_time() {
+    print("%02d:%02d:%02d", hours, minutes, seconds);
+}
+
+// Busy waits. With a calibrated TSC, this also works with interrupts disabled, otherwise we count ticks.
+void pit_sleep(uint32_t ms) {
+    if (tsc_get_khz()) {
+        uint64_t start = tsc_read(), cycles = (uint64_t) ms * tsc_get_khz();
+        while (tsc_read() - start < cycles)
+            asm volatile("pause");
+        return;
     }
+    // The tick counter may overflow while we wait, but the signed difference stays right (like in the timer wheel).
+    uint32_t deadline = ticks + pit_ms_to_ticks(ms);
+    while ((int32_t) (deadline - *(volatile uint32_t*) &ticks) > 0)
+        asm volatile("pause");
 }
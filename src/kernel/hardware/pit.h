@@ -4,21 +4,14 @@
 #include <stdint.h>
 #include <interrupts/isr.h>
 
-typedef struct {
-    uint32_t wait_until;
-    enum {
-        PIT_INVALID,
-        PIT_WAITING_UNTIL_OVERFLOW,
-        PIT_WAITING_UNTIL_TIMEOUT,
-        PIT_TIMED_OUT
-    } state;
-} pit_timeout_t;
-
 uint8_t pit_init_channel(uint8_t channel, uint8_t mode, uint32_t freq);
 void pit_init(uint32_t new_freq);
+void pit_advance_clock(uint32_t elapsed);
+uint32_t pit_get_ticks();
+uint32_t pit_get_current_ticks();
+uint32_t pit_ms_to_ticks(uint32_t ms);
+void pit_delay(uint32_t ms);
 void pit_dump_time();
 void pit_sleep(uint32_t ms);
-pit_timeout_t pit_make_timeout(uint32_t ms);
-int8_t pit_timed_out(pit_timeout_t* timeout);
 
 #endif
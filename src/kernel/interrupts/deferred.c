@@ -0,0 +1,76 @@
+/**
+ * @file
+ * @addtogroup deferred
+ * @{
+ * Deferred Work
+ * 
+ * IRQ handlers run with interrupts disabled and hold the kernel lock, so
+ * every cycle they spend delays all other interrupts and CPUs. They should
+ * only acknowledge the device and queue the rest of the work here. A worker
+ * thread runs the queued work in order with interrupts enabled. The queue is
+ * a fixed-size ring buffer, so queueing never allocates memory. If the worker
+ * falls behind and the queue is full, new work is dropped.
+ * @see https://lwn.net/Articles/520076/
+ */
+
+#include <common.h>
+#include <interrupts/deferred.h>
+#include <interrupts/isr.h>
+#include <tasks/task.h>
+#include <tasks/wait.h>
+
+#define DEFERRED_QUEUE_SIZE 64 ///< must be a power of two
+
+/// a piece of deferred work
+typedef struct {
+    deferred_func_t func; ///< the function to call
+    uint32_t data;        ///< passed to the function
+} deferred_work_t;
+
+static deferred_work_t queue[DEFERRED_QUEUE_SIZE]; ///< work not done yet
+static uint32_t read_pos = 0, write_pos = 0; ///< free running, wrap via masking
+static uint32_t queued = 0, dropped = 0; ///< statistics
+static wait_queue_t worker_queue = {0}; ///< the worker waits here for work
+
+/// The worker thread. Runs queued work with interrupts enabled, forever.
+static void deferred_worker() {
+    while (1) {
+        isr_enable_interrupts(0); // IRQ handlers might queue work meanwhile
+        while (read_pos == write_pos)
+            wait_block(&worker_queue);
+        deferred_work_t work = queue[read_pos++ % DEFERRED_QUEUE_SIZE];
+        isr_enable_interrupts(1);
+        work.func(work.data);
+    }
+}
+
+/**
+ * Queues work to be done outside of interrupt handlers. Usually called from
+ * an IRQ handler.
+ * @param func the function to call
+ * @param data passed to the function
+ */
+void deferred_queue(deferred_func_t func, uint32_t data) {
+    uint8_t old_interrupts = isr_enable_interrupts(0);
+    if (write_pos - read_pos == DEFERRED_QUEUE_SIZE)
+        dropped++;
+    else {
+        queue[write_pos++ % DEFERRED_QUEUE_SIZE] = (deferred_work_t) {func, data};
+        queued++;
+        wait_wake_one(&worker_queue);
+    }
+    isr_enable_interrupts(old_interrupts);
+}
+
+/// Dumps how much work was queued and dropped. The dump is logged.
+void deferred_dump() {
+    logln("DEFER", "%d queued, %d dropped, %d pending",
+            queued, dropped, write_pos - read_pos);
+}
+
+/// Starts the worker thread. Should be called before IRQ handlers queue work.
+void deferred_init() {
+    task_create_kernel_thread(deferred_worker, _4KB);
+}
+
+/// @}
@@ -0,0 +1,21 @@
+/**
+ * @file
+ * @addtogroup deferred
+ * @{
+ */
+
+#ifndef INTERRUPTS_DEFERRED_H
+#define INTERRUPTS_DEFERRED_H
+
+#include <stdint.h>
+
+/// deferred work, called by the worker thread with interrupts enabled
+typedef void (*deferred_func_t)(uint32_t data);
+
+void deferred_queue(deferred_func_t func, uint32_t data);
+void deferred_dump();
+void deferred_init();
+
+#endif
+
+/// @}
@@ -114,8 +114,14 @@ void idt_init() {
     /// Sets up 0x30 as a syscall interrupt which might be called from RING3.
     extern void isr_intr_0x30();
     idt_init_entry_isr(0x30, &isr_intr_0x30, 3);
+    ISR_INIT(0x31); ISR_INIT(0x32); ISR_INIT(0x33); ISR_INIT(0xFF); /// Sets up the local APIC's vectors.
     idt_load();
     println("%2aok%a.");
 }
 
+/// Loads the IDT on another CPU. All CPUs share the same IDT.
+void idt_init_cpu() {
+    idt_load();
+}
+
 /// @}
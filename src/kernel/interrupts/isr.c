@@ -7,6 +7,24 @@
  * An ISR is responsible for handling IRQs, exceptions and syscalls. Here only
  * one common ISR is used, isr_handle_interrupt. It dispatches interrupts to
  * handlers (isr_handler_t) registered by isr_register_handler.
+ *
+ * With multiple CPUs, disabling interrupts does not keep other CPUs out of
+ * critical sections anymore. So there is one big kernel lock that is held
+ * whenever a CPU runs with interrupts disabled, which includes handling
+ * interrupts. This way, code that is safe with interrupts disabled on one CPU
+ * stays safe with multiple CPUs. The lock is recursive per CPU and the depth
+ * belongs to the running task, so the scheduler swaps it on task switches.
+ * The PMM, VMM, task table and scheduler have their own locks (see
+ * lib/spinlock.h), so kernel threads can use them without the kernel lock.
+ * For every vector, we count how often it fires and how long its handler
+ * takes, so interrupt storms and slow handlers show up. We also measure how
+ * long each CPU runs with interrupts disabled under the kernel lock (see
+ * isr_dump_stats()). Device handlers should do as little as possible and
+ * defer the rest, see deferred.c.
+ *
+ * Syscalls may also enter through SYSENTER, which skips the IDT lookup and
+ * the privilege checks of int $0x30. isr_sysenter in isr_asm.S builds the
+ * same CPU state an int $0x30 would, so syscalls don't notice the difference.
  * @see isr_asm.S
  * @see http://www.lowlevel.eu/wiki/Teil_5_-_Interrupts
  * @see http://www.lowlevel.eu/wiki/ISR
@@ -20,8 +38,20 @@
 #include <interrupts/syscall.h>
 #include <hardware/pit.h>
 #include <hardware/io/ps2.h>
+#include <hardware/cpu/smp.h>
+#include <hardware/cpu/lapic.h>
+#include <hardware/cpu/cpuid.h>
+#include <hardware/cpu/msr.h>
+#include <hardware/cpu/tsc.h>
+#include <hardware/ioapic.h>
+#include <lib/spinlock.h>
+#include <tasks/tss.h>
+#include <mem/gdt.h>
+#include <mem/vmm.h>
 #include <syscall.h>
 
+extern void isr_sysenter(); // see isr_asm.S
+
 /// whether the given interrupt vector is an exception
 #define IS_EXCEPTION(intr) ((intr) <= 0x1F)
 /// whether the given interrupt vector is an IRQ
@@ -33,18 +63,139 @@
 static isr_handler_t handlers[IDT_ENTRIES] = {0};
 /// a table that associates syscall IDs with handlers
 static void* syscalls[SYSCALL_NUMBER] = {0};
+/// The big kernel lock. The boot CPU holds it from the start (ticket 0)
+/// because it starts with interrupts disabled.
+static spinlock_t kernel_lock = {1, 0, "Kernel", 0, {1, 0, 0, 0}};
+/// statistics of an interrupt vector
+typedef struct {
+    uint32_t count;        ///< how often the vector fired
+    uint64_t total_cycles; ///< TSC cycles spent handling it
+    uint32_t max_cycles;   ///< the longest time spent handling it
+    uint64_t last_tsc;     ///< when it last fired
+} isr_stats_t;
+
+/// the statistics of all vectors, updated under the kernel lock
+static isr_stats_t stats[IDT_ENTRIES] = {{0}};
+/// spurious IRQ7 and IRQ15, see pic_handle_spurious()
+static uint32_t spurious_irq7 = 0, spurious_irq15 = 0;
+/// the longest time each CPU ran with interrupts disabled, in TSC cycles
+static uint32_t irqs_off_max[SMP_MAX_CPUS] = {0};
+/// where that happened, an interrupt vector or the address that enabled interrupts
+static uint32_t irqs_off_where[SMP_MAX_CPUS] = {0};
+
+/**
+ * Takes the big kernel lock, waiting for other CPUs if necessary. Interrupts
+ * need to be disabled.
+ */
+void isr_lock_kernel() {
+    if (smp_get_cpu()->lock_depth++) // we already hold the lock
+        return;
+    spinlock_lock(&kernel_lock);
+}
+
+/// Releases the big kernel lock if this was the outermost isr_lock_kernel().
+void isr_unlock_kernel() {
+    if (--smp_get_cpu()->lock_depth == 0)
+        spinlock_unlock(&kernel_lock);
+}
+
+/// Dumps the kernel lock's statistics. The dump is logged.
+void isr_dump_lock() {
+    spinlock_dump(&kernel_lock);
+}
 
 /**
- * Enables or disables interrupts. Only acts if necessary.
+ * Dumps the statistics of all vectors that fired, the spurious IRQs and the
+ * longest time each CPU ran with interrupts disabled. The dump is logged.
+ */
+void isr_dump_stats() {
+    uint64_t now = tsc_read();
+    for (uint32_t intr = 0; intr < IDT_ENTRIES; intr++)
+        if (stats[intr].count) // shifting avoids 64-bit divisions
+            logln("ISR", "INT%02x: %u fired, %u Kcycles total, %u cycles max, "
+                    "last %u Mcycles ago", intr, stats[intr].count,
+                    (uint32_t) (stats[intr].total_cycles >> 10), stats[intr].max_cycles,
+                    (uint32_t) ((now - stats[intr].last_tsc) >> 20));
+    logln("ISR", "spurious: %u IRQ7, %u IRQ15", spurious_irq7, spurious_irq15);
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++)
+        logln("ISR", irqs_off_where[i] < IDT_ENTRIES ?
+                "CPU %d: interrupts off for up to %u cycles (vector %02x)" :
+                "CPU %d: interrupts off for up to %u cycles (at %08x)",
+                i, irqs_off_max[i], irqs_off_where[i]);
+}
+
+/**
+ * Returns the statistics of an interrupt vector and the global ones.
+ * @param intr  the interrupt vector
+ * @param irqstats where to store the statistics
+ * @return 0 or -1 if the vector does not exist
+ */
+uint32_t isr_get_irqstats(uint32_t intr, irqstats_t* irqstats) {
+    if (intr >= IDT_ENTRIES)
+        return -1;
+    irqstats->vector = intr;
+    irqstats->count = stats[intr].count;
+    irqstats->total_cycles = stats[intr].total_cycles;
+    irqstats->max_cycles = stats[intr].max_cycles;
+    irqstats->since_last = stats[intr].count ? tsc_read() - stats[intr].last_tsc : 0;
+    irqstats->spurious_irq7 = spurious_irq7;
+    irqstats->spurious_irq15 = spurious_irq15;
+    irqstats->cpus = smp_get_cpu_number();
+    for (uint32_t i = 0; i < irqstats->cpus; i++) {
+        irqstats->irqs_off_max[i] = irqs_off_max[i];
+        irqstats->irqs_off_where[i] = irqs_off_where[i];
+    }
+    return 0;
+}
+
+/**
+ * Accounts for a handled interrupt.
+ * @param intr  the interrupt vector
+ * @param start when handling started
+ */
+static void isr_account_vector(uint32_t intr, uint64_t start) {
+    uint64_t now = tsc_read();
+    uint32_t cycles = now - start;
+    stats[intr].count++;
+    stats[intr].total_cycles += cycles;
+    if (cycles > stats[intr].max_cycles)
+        stats[intr].max_cycles = cycles;
+    stats[intr].last_tsc = now;
+}
+
+/**
+ * Records how long interrupts have been disabled on the current CPU. Called
+ * before they are enabled again.
+ * @param where the interrupt vector or code address responsible
+ */
+static void isr_account_irqs_off(uint32_t where) {
+    smp_cpu_t* cpu = smp_get_cpu();
+    if (!cpu->irqs_off_tsc) // we don't count the initialization
+        return;
+    uint32_t cycles = tsc_read() - cpu->irqs_off_tsc;
+    if (cycles > irqs_off_max[cpu->id]) {
+        irqs_off_max[cpu->id] = cycles;
+        irqs_off_where[cpu->id] = where;
+    }
+}
+
+/**
+ * Enables or disables interrupts. Only acts if necessary. This also releases
+ * or takes the big kernel lock.
  * @param enable the new interrupt flag
  * @return interrupt flag before calling isr_enable_interrupts()
  */
 uint8_t isr_enable_interrupts(uint8_t enable) {
     uint8_t old_interrupts = isr_get_interrupts();
     if (enable && !old_interrupts) {
+        isr_account_irqs_off((uint32_t) __builtin_return_address(0));
+        isr_unlock_kernel();
         asm volatile("sti");
-    } else if (!enable && old_interrupts)
+    } else if (!enable && old_interrupts) {
         asm volatile("cli");
+        isr_lock_kernel();
+        smp_get_cpu()->irqs_off_tsc = tsc_read();
+    }
     return old_interrupts;
 }
 
@@ -88,7 +239,8 @@ void isr_register_syscall(size_t id, void* syscall) {
 /**
  * Handles all interrupts. This function is called whenever an interrupt is
  * fired. It distinguishes which action to perform (call a handler, panic etc.)
- * and, for IRQs, notifies the PIC that this interrupt has been handled.
+ * and, for IRQs, notifies the PIC (or, if the I/O APIC delivered the IRQ, the
+ * local APIC) that this interrupt has been handled.
  * @param cpu
  * cpu has two functions here - as a pointer (CPU state) and as a value (ESP):<br>
  * cpu points to the CPU state and is the ESP pushed in isr_asm.S (the former
@@ -97,10 +249,18 @@ void isr_register_syscall(size_t id, void* syscall) {
  * The pointer returned by this function is a (possibly new) ESP if we want to
  * switch tasks (then we need to make sure that ESP points to a valid CPU state).<br>
  * If we don't want to switch tasks, we just return the ESP unchanged.
+ * The kernel lock taken here is released in isr_asm.S after the stack switch.
  * @see isr_common in isr_asm.S
  */
 cpu_state_t* isr_handle_interrupt(cpu_state_t* cpu) {
+    uint64_t start = smp_get_cpu()->irqs_off_tsc = tsc_read();
+    isr_lock_kernel();
     uint32_t intr = cpu->intr; // save intr so we might change the cpu state
+    if (IS_IRQ(intr) && !ioapic_get_enabled() && pic_handle_spurious(intr)) {
+        intr == ISR_IRQ(7) ? spurious_irq7++ : spurious_irq15++;
+        isr_account_irqs_off(intr);
+        return cpu;
+    }
     if (handlers[intr])
         cpu = handlers[intr](cpu); // execute a handler if registered
     else {
@@ -112,7 +272,9 @@ cpu_state_t* isr_handle_interrupt(cpu_state_t* cpu) {
             print("%4aSYS%08x%a", cpu->r.eax);
     }
     if (IS_IRQ(intr))
-        pic_send_eoi(intr);
+        ioapic_get_enabled() ? lapic_send_eoi() : pic_send_eoi(intr);
+    isr_account_vector(intr, start);
+    isr_account_irqs_off(intr);
     return cpu;
 }
 
@@ -148,11 +310,55 @@ static cpu_state_t* isr_handle_syscall(cpu_state_t* cpu) {
     return cpu;
 }
 
+/**
+ * Handles syscalls that entered with SYSENTER. The user stub passed its stack
+ * in ECX and its return address in EDX, so it saved the 2nd and 3rd parameter
+ * on its stack and we fetch them from there. ECX is set by user space, so the
+ * syscall fails with -1 if it does not point to the task's memory.
+ * @param cpu the current CPU state, built by isr_sysenter in isr_asm.S
+ * @return the new CPU state (if a task switch is desired)
+ */
+cpu_state_t* isr_handle_sysenter(cpu_state_t* cpu) {
+    uint64_t start = smp_get_cpu()->irqs_off_tsc = tsc_read();
+    isr_lock_kernel();
+    uint32_t* user_stack = (uint32_t*) cpu->user_esp, eip = cpu->eip;
+    cpu_state_t* new_cpu = cpu;
+    if (vmm_check_user_memory(user_stack, 2 * sizeof(uint32_t), 0)) {
+        cpu->r.ecx = user_stack[0];
+        cpu->r.edx = user_stack[1];
+        new_cpu = isr_handle_syscall(cpu);
+    } else
+        cpu->r.eax = -1;
+    /// Blocking syscalls restart by moving EIP back to SYSENTER (which is 2
+    /// bytes long, just like int $0x30). If the task returns there with iret,
+    /// SYSENTER needs ECX and EDX to hold the user stack and return address
+    /// again. (The stub restores ECX and EDX from its stack anyway.)
+    cpu->r.ecx = cpu->user_esp;
+    cpu->r.edx = eip;
+    isr_account_vector(ISR_SYSCALL, start);
+    isr_account_irqs_off(ISR_SYSCALL);
+    return new_cpu;
+}
+
+/**
+ * Sets up SYSENTER on the current CPU if it is supported. SYSENTER loads a
+ * fixed stack pointer, so we point it to the CPU's TSS where the scheduler
+ * stores the current task's kernel stack.
+ */
+void isr_init_sysenter() {
+    if (!cpuid_get_features()->sep || !cpuid_get_features()->msr)
+        return;
+    msr_write(MSR_SYSENTER_CS, gdt_get_selector(GDT_RING0_CODE_SEG));
+    msr_write(MSR_SYSENTER_ESP, (uint32_t) tss_get_stack_address(smp_get_cpu()->id));
+    msr_write(MSR_SYSENTER_EIP, (uint32_t) isr_sysenter);
+}
+
 /// Initializes syscalls and enables interrupts.
 void isr_init() {
     print("ISR init ... ");
     isr_register_handler(ISR_SYSCALL, isr_handle_syscall);
     syscall_init();
+    isr_init_sysenter();
     isr_enable_interrupts(1);
     println("%2aok%a.");
 }
@@ -8,10 +8,15 @@
 #define INTERRUPTS_ISR_H
 
 #include <stdint.h>
+#include <irqstats.h>
 
 #define ISR_EXCEPTION(ex) (0x00 + (ex))  ///< the interrupt vector for an exception
 #define ISR_IRQ(irq)      (0x20 + (irq)) ///< the interrupt vector for an IRQ
 #define ISR_SYSCALL        0x30          ///< the interrupt vector for the syscall
+#define ISR_LAPIC_TIMER    0x31          ///< the local APIC timer's interrupt vector
+#define ISR_TLB_SHOOTDOWN  0x32          ///< the TLB shootdown IPI's vector, see mmu_shootdown_tlb()
+#define ISR_RESCHEDULE     0x33          ///< wakes up a CPU whose tick is stopped, see lapic_timer_kick()
+#define ISR_LAPIC_SPURIOUS 0xFF          ///< the local APIC's spurious interrupt vector
 
 /** The EFLAGS register. It contains control and status flags. */
 typedef union {
@@ -106,11 +111,17 @@ typedef cpu_state_t* (*isr_handler_t)(cpu_state_t* cpu);
 typedef uint32_t (*isr_syscall_t)(uint32_t ebx, uint32_t ecx, uint32_t edx,
         uint32_t esi, uint32_t edi, cpu_state_t** cpu);
 
+void isr_lock_kernel();
+void isr_unlock_kernel();
+void isr_dump_lock();
+void isr_dump_stats();
+uint32_t isr_get_irqstats(uint32_t intr, irqstats_t* irqstats);
 uint8_t isr_enable_interrupts(uint8_t enable);
 uint8_t isr_get_interrupts();
 void isr_register_handler(size_t intr, isr_handler_t handler);
 void isr_register_syscall(size_t eax, void* syscall);
 void isr_dump_cpu(cpu_state_t* cpu);
+void isr_init_sysenter();
 void isr_init();
 
 #endif
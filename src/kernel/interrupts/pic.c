@@ -6,6 +6,7 @@
  * 
  * The PIC manages IRQs (hardware interrupts). It maps actual IRQs to interrupt
  * vectors. After booting, the IRQs need to be remapped to avoid conflicts.
+ * If there is an I/O APIC, it takes over and the PIC is disabled, see ioapic.c.
  * @see http://wiki.osdev.org/8259_PIC
  * @see http://www.lowlevel.eu/wiki/PIC
  */
@@ -20,6 +21,7 @@
 #define PIC_EOI   0x20 ///< "end of interrupt" signals that an IRQ has been handled
 #define INT_IRQ0  0x20 ///< where we want to map the master PIC's IRQs
 #define INT_IRQ8  0x28 ///< where we want to map the slave PIC's IRQs
+#define PIC_READ_ISR 0x0B ///< OCW3: the next read from the command port returns the in-service register
 
 /// Initializes the PIC.
 void pic_init() {
@@ -65,4 +67,46 @@ void pic_send_eoi(uint8_t intr) {
     outb(PIC1_CMD, PIC_EOI);
 }
 
+/**
+ * Checks whether an IRQ7 or IRQ15 is spurious. A PIC fires these when an IRQ
+ * goes away before the CPU acknowledges it, but then no in-service bit is set.
+ * Spurious IRQs must not get an EOI, except that for a spurious IRQ15 the
+ * master PIC needs one because it doesn't know that the slave's was spurious.
+ * @param intr the interrupt vector
+ * @return whether the IRQ is spurious (it is handled then)
+ */
+uint8_t pic_handle_spurious(uint8_t intr) {
+    if (intr != INT_IRQ0 + 7 && intr != INT_IRQ8 + 7)
+        return 0;
+    uint16_t port = intr == INT_IRQ0 + 7 ? PIC1_CMD : PIC2_CMD;
+    outb(port, PIC_READ_ISR);
+    if (inb(port) & 0x80) // a real IRQ
+        return 0;
+    if (port == PIC2_CMD)
+        outb(PIC1_CMD, PIC_EOI);
+    return 1;
+}
+
+/**
+ * Masks or unmasks an IRQ. A masked IRQ is not fired until it is unmasked.
+ * @param irq    the IRQ (0-15)
+ * @param masked whether to mask or unmask the IRQ
+ */
+void pic_mask_irq(uint8_t irq, uint8_t masked) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    uint8_t mask = inb(port), bit = 1 << (irq % 8);
+    outb(port, masked ? mask | bit : mask & ~bit);
+}
+
+/**
+ * Masks all IRQs because the I/O APIC delivers them from now on.
+ * @return the previous mask, bit i is set if IRQ i was masked
+ */
+uint16_t pic_disable() {
+    uint16_t mask = inb(PIC1_DATA) | inb(PIC2_DATA) << 8;
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    return mask;
+}
+
 /// @}
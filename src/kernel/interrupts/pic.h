@@ -11,6 +11,9 @@
 
 void pic_init();
 void pic_send_eoi(uint8_t irq);
+uint8_t pic_handle_spurious(uint8_t intr);
+void pic_mask_irq(uint8_t irq, uint8_t masked);
+uint16_t pic_disable();
 
 #endif
 
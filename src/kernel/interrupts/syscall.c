@@ -8,37 +8,41 @@
  * functions. Syscalls may have up to 5 arguments and a return value.
  * They are called by firing a 0x30 interrupt with a syscall ID placed in EAX.
  * Parameters are placed in general purpose registers, the return value in EAX.
+ * Pointers come straight from user space, so every syscall that accesses
+ * memory through one checks it with vmm_check_user_memory() first and fails
+ * with -1 if the memory is not the task's. Otherwise a task could make the
+ * kernel read or write any kernel address.
+ * Syscalls that might switch tasks get the CPU state pointer as their last
+ * argument. The return value is only written to EAX if no task switch
+ * happened (see isr_handle_syscall()), so these syscalls set the current
+ * task's EAX themselves before switching.
  */
 
 #include <common.h>
 #include <interrupts/syscall.h>
 #include <interrupts/isr.h>
 #include <tasks/schedule.h>
+#include <tasks/ring.h>
+#include <hardware/io/input.h>
+#include <hardware/cpu/tsc.h>
+#include <hardware/ioapic.h>
+#include <mem/gdt.h>
+#include <mem/vmm.h>
 #include <syscall.h>
 
 /**
- * Exits the current task.
+ * Exits the current task. Even the last running task may exit, this CPU's idle
+ * task takes over then.
  * @param return_value whether the task returned successfully (0) or not
  * @param ecx ignored
  * @param edx ignored
  * @param esi ignored
  * @param edi ignored
  * @param cpu the CPU state pointer so we can switch to the next task
- * @todo process the return value and return it to the calling task
  */
 static void syscall_exit(uint32_t return_value, uint32_t ecx,
         uint32_t edx, uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
-    task_pid_t current_task = schedule_get_current_task();
-    task_pid_t next_task = schedule_get_next_task();
-    if (current_task == next_task) {
-        println("%4aThe last task cannot exit%a");
-    }
-    /// We tell the scheduler to not switch to this task again, so we can
-    /// properly free it later in schedule_finalize_tasks(). We can't do that
-    /// here because we are operating on this task's kernel stack which we
-    /// cannot free while it is still in use.
-    task_stop(current_task);
-    *cpu = schedule_switch_task(next_task);
+    *cpu = schedule_exit(*cpu, return_value);
 }
 
 /**
@@ -49,12 +53,291 @@ static uint32_t syscall_getpid() {
     return schedule_get_current_task();
 }
 
+/**
+ * Sets a task's base priority in the scheduler's feedback queue.
+ * @param pid      the task's PID, 0 for the current task
+ * @param priority the new base priority (0 is the highest)
+ * @return the old base priority or -1 on error
+ */
+static uint32_t syscall_setpriority(uint32_t pid, uint32_t priority) {
+    if (priority >= SCHEDULE_PRIORITIES)
+        return -1;
+    return schedule_set_priority(pid, priority);
+}
+
+/**
+ * Moves a task into the real-time class, see schedule_set_realtime().
+ * @param pid    the task's PID, 0 for the current task
+ * @param period the period in milliseconds, 0 to leave the real-time class
+ * @param budget the milliseconds the task may run per period
+ * @return 0 or -1 if the task was not admitted
+ */
+static uint32_t syscall_setrealtime(uint32_t pid, uint32_t period, uint32_t budget) {
+    return schedule_set_realtime(pid, period, budget);
+}
+
+/**
+ * Pins a task to some CPUs, see schedule_set_affinity().
+ * @param pid      the task's PID, 0 for the current task
+ * @param affinity a bit mask with bit i set if the task may run on CPU i
+ * @return 0 or -1 if the task does not exist or no running CPU is allowed
+ */
+static uint32_t syscall_setaffinity(uint32_t pid, uint32_t affinity) {
+    return schedule_set_affinity(pid, affinity);
+}
+
+/**
+ * Blocks the current task for a given time.
+ * @param ms  how many milliseconds to sleep
+ * @param ecx ignored
+ * @param edx ignored
+ * @param esi ignored
+ * @param edi ignored
+ * @param cpu the CPU state pointer so we can switch to the next task
+ * @return 0
+ */
+static uint32_t syscall_sleep(uint32_t ms, uint32_t ecx, uint32_t edx,
+        uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    (*cpu)->r.eax = 0;
+    *cpu = schedule_sleep(*cpu, ms);
+    return 0;
+}
+
+/**
+ * Gives up the CPU so that another task may run.
+ * @param ebx ignored
+ * @param ecx ignored
+ * @param edx ignored
+ * @param esi ignored
+ * @param edi ignored
+ * @param cpu the CPU state pointer so we can switch to the next task
+ * @return 0
+ */
+static uint32_t syscall_yield(uint32_t ebx, uint32_t ecx, uint32_t edx,
+        uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    (*cpu)->r.eax = 0;
+    *cpu = schedule_yield(*cpu);
+    return 0;
+}
+
+/**
+ * Gives up the CPU in favor of a given task.
+ * @param pid the task to switch to
+ * @param ecx ignored
+ * @param edx ignored
+ * @param esi ignored
+ * @param edi ignored
+ * @param cpu the CPU state pointer so we can switch to the next task
+ * @return 0 or -1 if the given task is not runnable
+ */
+static uint32_t syscall_yield_to(uint32_t pid, uint32_t ecx, uint32_t edx,
+        uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    (*cpu)->r.eax = 0;
+    cpu_state_t* next_cpu = schedule_yield_to(*cpu, pid);
+    if (!next_cpu)
+        return -1;
+    *cpu = next_cpu;
+    return 0;
+}
+
+/**
+ * Returns a task's CPU accounting.
+ * @param pid   the task's PID, 0 for the current task
+ * @param stats where to store the statistics
+ * @return 0 or -1 if the task does not exist or the statistics cannot be stored
+ */
+static uint32_t syscall_taskstats(uint32_t pid, taskstats_t* stats) {
+    if (!vmm_check_user_memory(stats, sizeof(taskstats_t), VMM_WRITABLE))
+        return -1;
+    return schedule_get_taskstats(pid, stats);
+}
+
+/**
+ * Returns the global scheduler statistics.
+ * @param stats where to store the statistics
+ * @return 0 or -1 if the statistics cannot be stored
+ */
+static uint32_t syscall_schedstats(schedstats_t* stats) {
+    if (!vmm_check_user_memory(stats, sizeof(schedstats_t), VMM_WRITABLE))
+        return -1;
+    *stats = *schedule_get_schedstats();
+    return 0;
+}
+
+/**
+ * Returns the statistics of an interrupt vector and the global interrupt
+ * statistics.
+ * @param vector the interrupt vector
+ * @param stats  where to store the statistics
+ * @return 0 or -1 if the vector does not exist or the statistics cannot be stored
+ */
+static uint32_t syscall_irqstats(uint32_t vector, irqstats_t* stats) {
+    if (!vmm_check_user_memory(stats, sizeof(irqstats_t), VMM_WRITABLE))
+        return -1;
+    return isr_get_irqstats(vector, stats);
+}
+
+/**
+ * Delivers an IRQ to a given CPU, see ioapic_set_affinity().
+ * @param irq the ISA IRQ
+ * @param cpu the CPU's ID
+ * @return 0 or -1 if the IRQ or CPU is invalid or there is no I/O APIC
+ */
+static uint32_t syscall_irqaffinity(uint32_t irq, uint32_t cpu) {
+    return irq < 256 && ioapic_set_affinity(irq, cpu) ? 0 : -1;
+}
+
+/**
+ * Reads a clock with nanosecond resolution.
+ * @param clock the clock, only CLOCK_MONOTONIC is supported
+ * @param time  where to store the time
+ * @return 0 or -1 if the clock is not available or the time cannot be stored
+ */
+static uint32_t syscall_clock_gettime(uint32_t clock, timespec_t* time) {
+    if (clock != CLOCK_MONOTONIC || !tsc_get_khz() ||
+            !vmm_check_user_memory(time, sizeof(timespec_t), VMM_WRITABLE))
+        return -1;
+    time->tv_sec = tsc_divide(tsc_get_ns(), 1000000000, &time->tv_nsec);
+    return 0;
+}
+
+/**
+ * Creates a thread in the current task's address space.
+ * @param entry_point the thread function, must call sys_exit instead of returning
+ * @param arg         the argument passed to the thread function
+ * @return the thread's PID
+ */
+static uint32_t syscall_thread_create(void* entry_point, void* arg) {
+    return task_create_thread(schedule_get_current_task(), entry_point, arg,
+            _4KB, _4KB);
+}
+
+/**
+ * Waits for a child task (i.e. a thread created by the current task) to exit.
+ * @param pid       the child's PID
+ * @param exit_code where to store the value the child passed to sys_exit, may be 0
+ * @param edx       ignored
+ * @param esi       ignored
+ * @param edi       ignored
+ * @param cpu       the CPU state pointer so we can switch to the next task
+ * @return the child's PID or -1 if the given task is not a child or the exit
+ *         code cannot be stored
+ */
+static uint32_t syscall_waitpid(uint32_t pid, uint32_t* exit_code, uint32_t edx,
+        uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    if (exit_code && !vmm_check_user_memory(exit_code, sizeof(uint32_t), VMM_WRITABLE))
+        return -1;
+    uint32_t ret = schedule_collect(pid, exit_code);
+    if (ret)
+        return ret;
+    /// If the child is still running, we block and restart the syscall when
+    /// some task exits (see syscall_read_input()).
+    (*cpu)->eip -= 2;
+    *cpu = schedule_wait_exit(*cpu);
+    return SYSCALL_WAITPID; // EAX must still hold the ID if we didn't switch
+}
+
+/**
+ * Reads a keyboard or mouse event. Blocks until an event is available.
+ * @param event where to store the event
+ * @param ecx   ignored
+ * @param edx   ignored
+ * @param esi   ignored
+ * @param edi   ignored
+ * @param cpu   the CPU state pointer so we can switch to the next task
+ * @return 1 or -1 if the event cannot be stored
+ */
+static uint32_t syscall_read_input(input_event_t* event, uint32_t ecx,
+        uint32_t edx, uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    if (!vmm_check_user_memory(event, sizeof(input_event_t), VMM_WRITABLE))
+        return -1;
+    if (input_read(event))
+        return 1;
+    /// If there is no event yet, we block and restart the syscall when woken
+    /// up by moving EIP back to the int 0x30 or SYSENTER instruction (both 2
+    /// bytes long).
+    (*cpu)->eip -= 2;
+    *cpu = input_wait(*cpu);
+    return SYSCALL_READ_INPUT; // EAX must still hold the ID if we didn't switch
+}
+
+/**
+ * Sets the current task's thread-local storage. Afterwards, GS:0 addresses
+ * the given base in user space.
+ * @param base where the task's thread-local storage begins
+ * @return 0
+ */
+static uint32_t syscall_set_tls(void* base) {
+    task_set_tls(schedule_get_current_task(), (uint32_t) base);
+    gdt_set_tls((uint32_t) base); // takes effect when GS is popped in isr_asm.S
+    return 0;
+}
+
+/**
+ * Writes a buffer to a file. The buffer is validated once and rendered in one
+ * go, which is a lot cheaper than one syscall per character. Also used by
+ * RING_WRITE submissions, see ring.c.
+ * @param fd  the file descriptor, only IO_STDOUT (the screen) is supported
+ * @param buf the characters to write
+ * @param len the number of characters
+ * @return the number of characters written or -1 on error
+ */
+uint32_t syscall_write(uint32_t fd, char* buf, uint32_t len) {
+    if (fd != IO_STDOUT || !vmm_check_user_memory(buf, len, 0))
+        return -1;
+    for (uint32_t i = 0; i < len; i++)
+        io_putchar(buf[i]);
+    return len;
+}
+
+/**
+ * Creates the current task's submission/completion ring.
+ * @return the ring or 0 on error
+ */
+static ring_t* syscall_ring_setup() {
+    return ring_setup();
+}
+
+/**
+ * Starts the submissions in the current task's ring. Blocks until enough
+ * completions are ready.
+ * @param to_submit    how many submissions to start at most
+ * @param min_complete how many completions to wait for
+ * @param edx          ignored
+ * @param esi          ignored
+ * @param edi          ignored
+ * @param cpu          the CPU state pointer so we can switch to the next task
+ * @return the number of completions ready or -1 on error
+ */
+static uint32_t syscall_ring_enter(uint32_t to_submit, uint32_t min_complete,
+        uint32_t edx, uint32_t esi, uint32_t edi, cpu_state_t** cpu) {
+    return ring_enter(to_submit, min_complete, cpu);
+}
+
 /// Initializes the syscall interface.
 void syscall_init() {
     isr_register_syscall(SYSCALL_EXIT,       syscall_exit);
     isr_register_syscall(SYSCALL_GETPID,     syscall_getpid);
     isr_register_syscall(SYSCALL_IO_PUTCHAR, io_putchar);
     isr_register_syscall(SYSCALL_IO_ATTR,    io_attr);
+    isr_register_syscall(SYSCALL_SETPRIORITY, syscall_setpriority);
+    isr_register_syscall(SYSCALL_SLEEP,       syscall_sleep);
+    isr_register_syscall(SYSCALL_READ_INPUT,  syscall_read_input);
+    isr_register_syscall(SYSCALL_YIELD,       syscall_yield);
+    isr_register_syscall(SYSCALL_YIELD_TO,    syscall_yield_to);
+    isr_register_syscall(SYSCALL_TASKSTATS,   syscall_taskstats);
+    isr_register_syscall(SYSCALL_SCHEDSTATS,  syscall_schedstats);
+    isr_register_syscall(SYSCALL_THREAD_CREATE, syscall_thread_create);
+    isr_register_syscall(SYSCALL_WAITPID,     syscall_waitpid);
+    isr_register_syscall(SYSCALL_SET_TLS,     syscall_set_tls);
+    isr_register_syscall(SYSCALL_SETREALTIME, syscall_setrealtime);
+    isr_register_syscall(SYSCALL_SETAFFINITY, syscall_setaffinity);
+    isr_register_syscall(SYSCALL_WRITE,       syscall_write);
+    isr_register_syscall(SYSCALL_RING_SETUP,  syscall_ring_setup);
+    isr_register_syscall(SYSCALL_RING_ENTER,  syscall_ring_enter);
+    isr_register_syscall(SYSCALL_IRQSTATS,    syscall_irqstats);
+    isr_register_syscall(SYSCALL_CLOCK_GETTIME, syscall_clock_gettime);
+    isr_register_syscall(SYSCALL_IRQAFFINITY, syscall_irqaffinity);
 }
 
 /// @}
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 
+uint32_t syscall_write(uint32_t fd, char* buf, uint32_t len);
 void syscall_init();
 
 #endif
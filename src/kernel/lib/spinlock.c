@@ -0,0 +1,92 @@
+/*
+ * Spinlock - ticket locks and reader-writer locks for multiple CPUs
+ *
+ * A CPU that wants the lock draws a ticket and spins until its number is
+ * served, so CPUs get the lock in FIFO order and nobody starves. Locks that
+ * are also taken in interrupt handlers must be taken with the _irqsave
+ * variants, otherwise an interrupt on the CPU holding the lock deadlocks.
+ * Every lock counts how often it was taken, how often a CPU had to wait for
+ * it and how long it was held.
+ *
+ * To avoid deadlocks, locks are always taken in this order:
+ * kernel lock (isr.c), ELF, scheduler, task table, VMM, PMM, I/O APIC.
+ * While spinning, a CPU answers TLB shootdowns because the lock's holder might
+ * be waiting for it, see mmu_handle_shootdown().
+ *
+ * http://wiki.osdev.org/Spinlock
+ * https://lwn.net/Articles/267968/ (ticket spinlocks)
+ * https://en.wikipedia.org/wiki/Readers%E2%80%93writer_lock
+ */
+
+#include <common.h>
+#include <lib/spinlock.h>
+#include <hardware/cpu/tsc.h>
+#include <mem/mmu.h>
+
+void spinlock_lock(spinlock_t* lock) {
+    uint32_t ticket = __sync_fetch_and_add(&lock->next_ticket, 1);
+    if (lock->now_serving != ticket) {
+        while (lock->now_serving != ticket) {
+            mmu_handle_shootdown();
+            asm volatile("pause");
+        }
+        lock->stats.contentions++; // safe, we hold the lock now
+    }
+    lock->stats.acquisitions++;
+    lock->lock_tsc = tsc_read();
+}
+
+void spinlock_unlock(spinlock_t* lock) {
+    uint64_t cycles = tsc_read() - lock->lock_tsc;
+    lock->stats.hold_cycles += cycles;
+    if (cycles > lock->stats.max_hold_cycles)
+        lock->stats.max_hold_cycles = cycles;
+    __sync_synchronize(); // all writes in the critical section must be visible
+    lock->now_serving++; // only the holder writes this, so no atomic needed
+}
+
+// takes the lock with interrupts disabled, returns the old interrupt flag
+uint8_t spinlock_lock_irqsave(spinlock_t* lock) {
+    uint8_t interrupts = spinlock_save_interrupts();
+    spinlock_lock(lock);
+    return interrupts;
+}
+
+void spinlock_unlock_irqrestore(spinlock_t* lock, uint8_t interrupts) {
+    spinlock_unlock(lock);
+    spinlock_restore_interrupts(interrupts);
+}
+
+uint8_t rwlock_read_lock_irqsave(rwlock_t* lock) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock->lock); // waits for writers
+    __sync_fetch_and_add(&lock->readers, 1);
+    spinlock_unlock(&lock->lock);
+    return interrupts;
+}
+
+void rwlock_read_unlock_irqrestore(rwlock_t* lock, uint8_t interrupts) {
+    __sync_fetch_and_sub(&lock->readers, 1);
+    spinlock_restore_interrupts(interrupts);
+}
+
+uint8_t rwlock_write_lock_irqsave(rwlock_t* lock) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock->lock); // no new readers
+    while (lock->readers) { // wait for the readers inside to leave
+        mmu_handle_shootdown();
+        asm volatile("pause");
+    }
+    return interrupts;
+}
+
+void rwlock_write_unlock_irqrestore(rwlock_t* lock, uint8_t interrupts) {
+    spinlock_unlock_irqrestore(&lock->lock, interrupts);
+}
+
+// logs the lock's statistics
+void spinlock_dump(spinlock_t* lock) {
+    // cycles are printed in thousands because we can only print 32 bits
+    logln("LOCK", "%s lock: taken %u times, %u contended, held %uK cycles "
+            "(longest %uK)", lock->name, lock->stats.acquisitions,
+            lock->stats.contentions, (uint32_t) (lock->stats.hold_cycles >> 10),
+            (uint32_t) (lock->stats.max_hold_cycles >> 10));
+}
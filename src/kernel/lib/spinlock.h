@@ -0,0 +1,52 @@
+#ifndef LIB_SPINLOCK_H
+#define LIB_SPINLOCK_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t acquisitions;    // how often the lock was taken
+    uint32_t contentions;     // how often another CPU was holding it at that time
+    uint64_t hold_cycles;     // TSC cycles the lock was held in total
+    uint64_t max_hold_cycles; // longest time the lock was held
+} spinlock_stats_t;
+
+typedef struct {
+    volatile uint32_t next_ticket; // the ticket the next CPU draws
+    volatile uint32_t now_serving; // the ticket whose owner holds the lock
+    char* name;                    // for dumping the statistics
+    uint64_t lock_tsc;             // when the lock was taken
+    spinlock_stats_t stats;
+} spinlock_t; // ticket lock, CPUs get the lock in the order they asked for it
+
+typedef struct {
+    spinlock_t lock;            // held by writers and briefly by entering readers
+    volatile uint32_t readers;  // number of readers inside
+} rwlock_t; // many readers or one writer, waiting writers block new readers
+
+#define SPINLOCK_INIT(name) {0, 0, (name), 0, {0, 0, 0, 0}}
+#define RWLOCK_INIT(name) {SPINLOCK_INIT(name), 0}
+
+// Disables interrupts on this CPU only. Unlike isr_enable_interrupts(), this
+// does not take the kernel lock.
+static inline uint8_t spinlock_save_interrupts() {
+    uint32_t eflags;
+    asm volatile("pushfl; pop %0; cli" : "=r" (eflags) : : "memory");
+    return (eflags >> 9) & 1; // the interrupt flag
+}
+
+static inline void spinlock_restore_interrupts(uint8_t interrupts) {
+    if (interrupts)
+        asm volatile("sti" : : : "memory");
+}
+
+void spinlock_lock(spinlock_t* lock);
+void spinlock_unlock(spinlock_t* lock);
+uint8_t spinlock_lock_irqsave(spinlock_t* lock);
+void spinlock_unlock_irqrestore(spinlock_t* lock, uint8_t interrupts);
+uint8_t rwlock_read_lock_irqsave(rwlock_t* lock);
+void rwlock_read_unlock_irqrestore(rwlock_t* lock, uint8_t interrupts);
+uint8_t rwlock_write_lock_irqsave(rwlock_t* lock);
+void rwlock_write_unlock_irqrestore(rwlock_t* lock, uint8_t interrupts);
+void spinlock_dump(spinlock_t* lock);
+
+#endif
@@ -6,7 +6,12 @@
  * 
  * The GDT defines memory segments that can be used for memory protection.
  * Here we use a flat memory model, therefore we only need 2 entries for
- * the kernel and user space each and a TSS.
+ * the kernel and user space each and a TSS. The only exception is the TLS
+ * segment which user tasks load into GS. Its base is changed on every task
+ * switch so that each task finds its thread-local storage at GS:0.
+ * Every CPU has its own GDT, so it can have its own TSS and TLS segment. The
+ * kernel keeps the CPU segment in FS, its base points to the CPU's per-CPU
+ * data (see smp_get_cpu()).
  * @see gdt_asm.S
  * @see http://www.lowlevel.eu/wiki/Global_Descriptor_Table
  * @see http://wiki.osdev.org/Segmentation
@@ -19,6 +24,7 @@
 #include <common.h>
 #include <mem/gdt.h>
 #include <tasks/tss.h>
+#include <hardware/cpu/smp.h>
 
 /// the GDTR register pointing to the GDT
 typedef struct {
@@ -37,16 +43,17 @@ typedef union {
     uint16_t word;           ///< useful for casting
 } gdt_selector_t;
 
-/// The GDT itself. It is located inside the kernel.
-static gdt_entry_t gdt[GDT_ENTRIES];
+/// The GDTs themselves, one per CPU. They are located inside the kernel.
+static gdt_entry_t gdts[SMP_MAX_CPUS][GDT_ENTRIES];
 
 /**
  * Sets basic parameters of a GDT entry.
+ * @param gdt   the GDT
  * @param entry index into the GDT
  * @param base  where the segment begins
  * @param limit maximum offset allowed
  */
-void gdt_init_entry(size_t entry, uint32_t base, uint32_t limit) {
+void gdt_init_entry(gdt_entry_t* gdt, size_t entry, uint32_t base, uint32_t limit) {
     gdt[entry].base0_23   =  base         & 0xFFFFFF; // 24 lower bits
     gdt[entry].base24_31  = (base >> 24)  & 0xFF;     // 8 higher bits
     gdt[entry].limit0_15  =  limit        & 0xFFFF;   // 16 lower bits
@@ -54,9 +61,13 @@ void gdt_init_entry(size_t entry, uint32_t base, uint32_t limit) {
     gdt[entry].reserved   = 0;
 }
 
-/// Loads the GDT into the GDTR register.
-static void gdt_load() {
-    gdtr_t gdtr = {.base = (uint32_t) gdt, .limit = sizeof(gdt) - 1};
+/**
+ * Loads a GDT into the GDTR register.
+ * @param gdt the GDT
+ */
+static void gdt_load(gdt_entry_t* gdt) {
+    gdtr_t gdtr = {.base = (uint32_t) gdt,
+        .limit = GDT_ENTRIES * sizeof(gdt_entry_t) - 1};
     asm volatile("lgdt %0" : : "m" (gdtr));
 }
 
@@ -67,25 +78,40 @@ static void gdt_load() {
 extern void gdt_flush();
 
 /**
- * Initializes the GDT. Creates the following descriptors for a flat memory model:
+ * Initializes a CPU's GDT. Creates the following descriptors for a flat
+ * memory model:
+ * @param cpu the CPU's index, see smp_get_cpu_by_id()
  */
-void gdt_init() {
-    print("GDT init ... ");
-    gdt_init_entry(0, 0, 0);                        /// - null descriptor
-    gdt_init_entry(GDT_RING0_CODE_SEG, 0, 0xFFFFF); /// - kernel code segment
-    gdt_init_entry(GDT_RING0_DATA_SEG, 0, 0xFFFFF); /// - kernel data segment
-    gdt_init_entry(GDT_RING3_CODE_SEG, 0, 0xFFFFF); /// - user code segment
-    gdt_init_entry(GDT_RING3_DATA_SEG, 0, 0xFFFFF); /// - user data segment
+void gdt_init_cpu(uint32_t cpu) {
+    gdt_entry_t* gdt = gdts[cpu];
+    gdt_init_entry(gdt, 0, 0, 0);                        /// - null descriptor
+    gdt_init_entry(gdt, GDT_RING0_CODE_SEG, 0, 0xFFFFF); /// - kernel code segment
+    gdt_init_entry(gdt, GDT_RING0_DATA_SEG, 0, 0xFFFFF); /// - kernel data segment
+    gdt_init_entry(gdt, GDT_RING3_CODE_SEG, 0, 0xFFFFF); /// - user code segment
+    gdt_init_entry(gdt, GDT_RING3_DATA_SEG, 0, 0xFFFFF); /// - user data segment
+    gdt_init_entry(gdt, GDT_TLS_SEG,        0, 0xFFFFF); /// - user TLS segment
+    gdt_init_entry(gdt, GDT_CPU_SEG, (uint32_t) smp_get_cpu_by_id(cpu),
+            sizeof(smp_cpu_t) - 1); /// - per-CPU data segment
     gdt[0].ac = 0; gdt[0].rw = 0; gdt[0].dc = 0; gdt[0].ex = 0; gdt[0].dt = 0; gdt[0].dpl = 0; gdt[0].pr = 0; gdt[0].sz = 0; gdt[0].gr = 0;
     gdt[1].ac = 0; gdt[1].rw = 1; gdt[1].dc = 0; gdt[1].ex = 1; gdt[1].dt = 1; gdt[1].dpl = 0; gdt[1].pr = 1; gdt[1].sz = 1; gdt[1].gr = 1;
     gdt[2].ac = 0; gdt[2].rw = 1; gdt[2].dc = 0; gdt[2].ex = 0; gdt[2].dt = 1; gdt[2].dpl = 0; gdt[2].pr = 1; gdt[2].sz = 1; gdt[2].gr = 1;
     gdt[3].ac = 0; gdt[3].rw = 1; gdt[3].dc = 0; gdt[3].ex = 1; gdt[3].dt = 1; gdt[3].dpl = 3; gdt[3].pr = 1; gdt[3].sz = 1; gdt[3].gr = 1;
     gdt[4].ac = 0; gdt[4].rw = 1; gdt[4].dc = 0; gdt[4].ex = 0; gdt[4].dt = 1; gdt[4].dpl = 3; gdt[4].pr = 1; gdt[4].sz = 1; gdt[4].gr = 1;
-    tss_init(gdt); /// - task state segment
+    gdt[6].ac = 0; gdt[6].rw = 1; gdt[6].dc = 0; gdt[6].ex = 0; gdt[6].dt = 1; gdt[6].dpl = 3; gdt[6].pr = 1; gdt[6].sz = 1; gdt[6].gr = 1;
+    gdt[7].ac = 0; gdt[7].rw = 1; gdt[7].dc = 0; gdt[7].ex = 0; gdt[7].dt = 1; gdt[7].dpl = 0; gdt[7].pr = 1; gdt[7].sz = 1; gdt[7].gr = 0;
+    tss_init(gdt, cpu); /// - task state segment
     /// Then loads the GDT into GDTR and sets the segments registers.
-    gdt_load();    
+    gdt_load(gdt);
     gdt_flush();
+    uint16_t cpu_selector = gdt_get_selector(GDT_CPU_SEG); /// FS points to the
+    asm volatile("mov %0, %%fs" : : "r" (cpu_selector)); /// per-CPU data.
     tss_load(); /// It also loads the TSS into the TR register.
+}
+
+/// Initializes the boot CPU's GDT.
+void gdt_init() {
+    print("GDT init ... ");
+    gdt_init_cpu(0);
     println("%2aok%a.");
 }
 
@@ -99,10 +125,26 @@ void gdt_init() {
  * @see GDT_RING3_CODE_SEG
  * @see GDT_RING3_DATA_SEG
  * @see GDT_TASK_STATE_SEG
+ * @see GDT_TLS_SEG
+ * @see GDT_CPU_SEG
  */
 uint16_t gdt_get_selector(size_t entry) {
-    gdt_selector_t selector = {.bits = {.dpl = gdt[entry].dpl, .entry = entry}};
+    // the privilege levels are the same in every CPU's GDT
+    gdt_selector_t selector = {.bits = {.dpl = gdts[0][entry].dpl, .entry = entry}};
     return (uint16_t) selector.word; // selector used in IDT and segment registers
 }
 
+/**
+ * Sets the base of the current CPU's TLS segment. The segment is a flat 4GiB
+ * segment, so offsets wrap around and GS:x addresses base + x. The CPU only
+ * reads the new base when GS is reloaded, which isr_asm.S does when leaving
+ * the kernel.
+ * @param base where the current task's thread-local storage begins
+ */
+void gdt_set_tls(uint32_t base) {
+    gdt_entry_t* gdt = gdts[smp_get_cpu()->id];
+    gdt[GDT_TLS_SEG].base0_23  =  base        & 0xFFFFFF;
+    gdt[GDT_TLS_SEG].base24_31 = (base >> 24) & 0xFF;
+}
+
 /// @}
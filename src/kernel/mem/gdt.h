@@ -9,12 +9,14 @@
 
 #include <stdint.h>
 
-#define GDT_ENTRIES        6 ///< number of entries in the GDT @see gdt_init
+#define GDT_ENTRIES        8 ///< number of entries in the GDT @see gdt_init
 #define GDT_RING0_CODE_SEG 1 ///< kernel code segment index
 #define GDT_RING0_DATA_SEG 2 ///< kernel data segment index
 #define GDT_RING3_CODE_SEG 3 ///< user code segment index
 #define GDT_RING3_DATA_SEG 4 ///< user data segment index
 #define GDT_TASK_STATE_SEG 5 ///< task state segment index
+#define GDT_TLS_SEG        6 ///< user thread-local storage segment index (GS)
+#define GDT_CPU_SEG        7 ///< per-CPU data segment index (FS in the kernel)
 
 /** An entry in the GDT. This corresponds directly to a memory segment or TSS. */
 typedef struct {
@@ -35,9 +37,11 @@ typedef struct {
     uint8_t  base24_31  :  8; ///< where the segment begins (byte 4)
 } __attribute__((packed)) gdt_entry_t;
 
-void gdt_init_entry(size_t entry, uint32_t base, uint32_t limit);
+void gdt_init_entry(gdt_entry_t* gdt, size_t entry, uint32_t base, uint32_t limit);
+void gdt_init_cpu(uint32_t cpu);
 void gdt_init();
 uint16_t gdt_get_selector(size_t entry);
+void gdt_set_tls(uint32_t base);
 
 #endif
 
@@ -5,15 +5,21 @@
  * Memory Management Unit
  * 
  * The MMU deals with technical details of paging and the Translation Lookaside
- * Buffer.
+ * Buffer. Every CPU has its own TLB, so when a CPU removes a mapping that other
+ * CPUs might have cached, it asks them to flush it with an inter-processor
+ * interrupt and waits until they did (a TLB shootdown).
  * @see http://wiki.osdev.org/Memory_Management_Unit
  * @see http://www.lowlevel.eu/wiki/Steuerregister
  * @see http://wiki.osdev.org/TLB
+ * @see https://www.kernel.org/doc/Documentation/x86/tlb.txt
  */
 
 #include <common.h>
 #include <interrupts/isr.h>
 #include <mem/mmu.h>
+#include <hardware/cpu/lapic.h>
+#include <hardware/cpu/smp.h>
+#include <string.h>
 
 /// page fault error information
 typedef union {
@@ -27,6 +33,17 @@ typedef union {
     uint32_t dword;           ///< useful for casting
 } mmu_page_fault_error_t;
 
+/// a request to other CPUs to flush some pages from their TLBs
+typedef struct {
+    void* addresses[MMU_SHOOTDOWN_BATCH]; ///< the pages to flush
+    uint32_t count;         ///< the number of pages or MMU_FLUSH_ALL
+    volatile uint32_t cpus; ///< bit i is set until CPU i has flushed its TLB
+} mmu_shootdown_t;
+
+static mmu_shootdown_t shootdown = {{0}}; ///< the shootdown in progress
+static uint32_t shootdowns_sent[SMP_MAX_CPUS] = {0}; ///< shootdowns per sending CPU
+static uint32_t shootdowns_received[SMP_MAX_CPUS] = {0}; ///< shootdowns per flushing CPU
+
 /**
  * Loads a page directory into the CR3 register.
  * @param page_directory physical address of a page directory
@@ -37,15 +54,18 @@ void mmu_load_page_directory(page_directory_t* page_directory) {
 }
 
 /**
- * Loads a page directory and enables paging.
+ * Loads a page directory and enables paging. Also sets the write protect flag
+ * so that the kernel can't write to read-only pages either, e.g. shared ELF
+ * code when a syscall is passed a bad pointer.
  * @param page_directory physical address of a page directory (or 0 if paging
  *                       should be disabled)
  */
 void mmu_enable_paging(page_directory_t* page_directory) {
     if (page_directory) {
         mmu_load_page_directory(page_directory); // first load the initial directory
-        // then set bit 31 (the paging flag) in control register 0 to enable paging    
-        asm volatile("mov %cr0, %eax; or $0x80000000, %eax; mov %eax, %cr0");
+        // then set bit 31 (the paging flag) in control register 0 to enable paging
+        // and bit 16 (the write protect flag)
+        asm volatile("mov %cr0, %eax; or $0x80010000, %eax; mov %eax, %cr0");
     } else
         asm volatile("mov %cr0, %eax; and $0x7FFFFFFF, %eax; mov %eax, %cr0");
 }
@@ -72,6 +92,69 @@ void mmu_flush_tlb(void* vaddr) {
     asm volatile("invlpg (%0)" : : "r" (vaddr) : "memory"); // do funny things.
 }
 
+/**
+ * Makes other CPUs flush the given pages from their TLBs and waits until they
+ * did. This CPU's TLB is not flushed, that is up to the caller. Only one
+ * shootdown may be in progress at a time, the VMM lock takes care of that.
+ * @param cpus      a bit mask with bit i set if CPU i needs to flush the pages
+ * @param addresses the virtual addresses of the pages
+ * @param count     the number of pages or MMU_FLUSH_ALL to flush all pages
+ */
+void mmu_shootdown_tlb(uint32_t cpus, void** addresses, uint32_t count) {
+    uint32_t id = smp_get_cpu()->id;
+    cpus &= ((1 << smp_get_cpu_number()) - 1) & ~(1 << id); // only running CPUs
+    if (!cpus)
+        return;
+    shootdown.count = count > MMU_SHOOTDOWN_BATCH ? MMU_FLUSH_ALL : count;
+    if (shootdown.count != MMU_FLUSH_ALL)
+        memcpy(shootdown.addresses, addresses, count * sizeof(void*));
+    __sync_synchronize(); // the request must be visible before the CPUs answer
+    shootdown.cpus = cpus;
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++)
+        if ((cpus >> i) & 1)
+            lapic_send_ipi(smp_get_cpu_by_id(i)->lapic_id, ISR_TLB_SHOOTDOWN);
+    shootdowns_sent[id]++;
+    while (shootdown.cpus)
+        asm volatile("pause");
+}
+
+/**
+ * Flushes this CPU's TLB if another CPU asked for it with mmu_shootdown_tlb().
+ * Besides the shootdown IPI, CPUs spinning on a lock call this because the
+ * CPU waiting for them might hold that lock (with interrupts disabled, the IPI
+ * would never arrive).
+ */
+void mmu_handle_shootdown() {
+    uint32_t id = smp_get_cpu()->id;
+    if (!((shootdown.cpus >> id) & 1))
+        return; // nothing to do or we already answered while spinning
+    if (shootdown.count == MMU_FLUSH_ALL) {
+        uint32_t cr3;
+        asm volatile("mov %%cr3, %0" : "=r" (cr3));
+        mmu_load_page_directory((page_directory_t*) cr3);
+    } else
+        for (uint32_t i = 0; i < shootdown.count; i++)
+            mmu_flush_tlb(shootdown.addresses[i]);
+    shootdowns_received[id]++;
+    __sync_fetch_and_and(&shootdown.cpus, ~(1 << id));
+}
+
+/**
+ * Handles the TLB shootdown IPI. This runs without the kernel lock.
+ * @see isr_intr_0x32 in isr_asm.S
+ */
+void mmu_handle_shootdown_interrupt() {
+    mmu_handle_shootdown();
+    lapic_send_eoi();
+}
+
+/// Dumps how many TLB shootdowns each CPU sent and received. The dump is logged.
+void mmu_dump() {
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++)
+        logln("MMU", "CPU %u: %u TLB shootdowns sent, %u received", i,
+                shootdowns_sent[i], shootdowns_received[i]);
+}
+
 /**
  * Handles page faults.
  * @param cpu the CPU state
@@ -10,10 +10,18 @@
 #include <stdint.h>
 #include <mem/vmm.h>
 
+/// how many pages one TLB shootdown may flush, more flush the whole TLB
+#define MMU_SHOOTDOWN_BATCH 16
+/// passed to mmu_shootdown_tlb() instead of a number of pages to flush all pages
+#define MMU_FLUSH_ALL ((uint32_t) -1)
+
 void mmu_load_page_directory(page_directory_t* page_directory);
 void mmu_enable_paging(page_directory_t* page_directory);
 uint8_t mmu_get_paging();
 void mmu_flush_tlb(void* vaddr);
+void mmu_shootdown_tlb(uint32_t cpus, void** addresses, uint32_t count);
+void mmu_handle_shootdown();
+void mmu_dump();
 void mmu_init();
 
 #endif
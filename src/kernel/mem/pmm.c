@@ -16,6 +16,7 @@
 #include <string.h>
 #include <mem/pmm.h>
 #include <boot/multiboot.h>
+#include <lib/spinlock.h>
 
 #define PAGE_SIZE       4096        ///< 4KB pages
 #define PAGE_SHIFT      12          ///< bits to shift to get page (2^12=4096)
@@ -39,6 +40,7 @@
  * dynamic allocation if we had it. This way we use up 2MiB of memory. */
 static uint32_t bitmap[PAGE_NUMBER / PAGES_PER_DWORD];
 static uint32_t highest_kernel_page = 0; ///< remember the highest kernel page
+static spinlock_t lock = SPINLOCK_INIT("PMM"); ///< protects the bitmap
 
 // symbols defined in script.ld and main_asm.S, only the addresses matter
 extern const void
@@ -132,14 +134,14 @@ void* pmm_get_address(uint32_t page, uint32_t offset) {
 }
 
 /**
- * Marks page frames for a given memory range as used or unused.
+ * Marks page frames for a given memory range as used or unused. The caller
+ * needs to hold the PMM lock.
  * @param ptr   the physical start address of the memory range
  * @param len   the length of the memory range in bytes
  * @param flags whether to allocate or free page frames
  * @param tag   a short string for the debug log
  */
-void pmm_use(void* ptr, size_t len, pmm_flags_t flags, char* tag) {
-    if (len == 0) return;
+static void pmm_mark(void* ptr, size_t len, pmm_flags_t flags, char* tag) {
     uint32_t start_page = pmm_get_page(ptr, 0), end_page = pmm_get_page(ptr, len - 1);
     log("PMM", "%s %08x-%08x (page %05x-%05x)", flags == PMM_UNUSED ? "Free" : "Use ",
             ptr, ptr + len - 1, start_page, end_page);
@@ -152,6 +154,20 @@ void pmm_use(void* ptr, size_t len, pmm_flags_t flags, char* tag) {
         highest_kernel_page = end_page;
 }
 
+/**
+ * Marks page frames for a given memory range as used or unused.
+ * @param ptr   the physical start address of the memory range
+ * @param len   the length of the memory range in bytes
+ * @param flags whether to allocate or free page frames
+ * @param tag   a short string for the debug log
+ */
+void pmm_use(void* ptr, size_t len, pmm_flags_t flags, char* tag) {
+    if (len == 0) return;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    pmm_mark(ptr, len, flags, tag);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+}
+
 /**
  * Finds free page frames.
  * @param len requested number of consecutive free bytes
@@ -181,10 +197,11 @@ static void* pmm_find_free(size_t len) {
  * @return the physical start address of the allocated memory range
  */
 void* pmm_alloc(size_t len, pmm_flags_t flags) {   
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
     void* ptr = pmm_find_free(len); // find some free pages in a row
-    if (!ptr)
-        return 0;
-    pmm_use(ptr, len, flags, "pmm_alloc"); // mark the pages as used
+    if (ptr)
+        pmm_mark(ptr, len, flags, "pmm_alloc"); // mark the pages as used
+    spinlock_unlock_irqrestore(&lock, interrupts);
     return ptr;
 }
 
@@ -226,6 +243,7 @@ void pmm_dump(void* ptr, size_t len) {
         log(0, "%x", pmm_bitmap_get(i));
     }
     logln(0, "");
+    spinlock_dump(&lock);
 }
 
 /**
@@ -6,6 +6,12 @@
  * 
  * The VMM manages paging and memory contexts. It maps virtual to physical
  * memory, allocates and frees virtual memory and switches page directories.
+ * All of this is protected by the VMM lock. Because the VMM functions call
+ * each other a lot, the lock may be taken recursively by the same CPU.
+ * Unmapped pages are flushed from the TLBs of all CPUs that might have cached
+ * them. Pages in the kernel domain may be cached by every CPU, user pages only
+ * by CPUs that have the same page directory loaded. The pages are collected
+ * while the lock is held and flushed in one batch when it is released.
  * @see http://wiki.osdev.org/Paging
  * @see http://www.lowlevel.eu/wiki/Paging
  * @see http://www.rohitab.com/discuss/topic/31139-tutorial-paging-memory-mapping-with-a-recursive-page-directory/
@@ -17,6 +23,8 @@
 #include <mem/mmu.h>
 #include <interrupts/isr.h>
 #include <boot/multiboot.h>
+#include <hardware/cpu/smp.h>
+#include <lib/spinlock.h>
 
 #define ENTRIES 1024 ///< number of entries in page directories and tables
 /// The number of bytes per page directory "happens" to equal the size of a page.
@@ -42,8 +50,15 @@ typedef union {
 } vmm_virtual_address_t;
 
 static page_directory_t* page_directory = 0; ///< the current page directory
+static page_directory_t* kernel_directory = 0; ///< physical address of the initial directory
 static page_directory_t* old_directory = 0; ///< for temporary modifications
-static uint8_t old_interrupts = 0; ///< for temporary modifications
+static spinlock_t lock = SPINLOCK_INIT("VMM"); ///< protects page directories and tables
+static uint32_t lock_cpu = -1; ///< the CPU holding the lock
+static uint32_t lock_depth = 0; ///< how often that CPU took the lock
+static uint8_t lock_interrupts = 0; ///< interrupt flag before taking the lock
+static void* flush_addresses[MMU_SHOOTDOWN_BATCH]; ///< pages unmapped under the lock
+static uint32_t flush_count = 0; ///< their number or MMU_FLUSH_ALL
+static uint32_t flush_cpus = 0; ///< CPUs that might still have them in their TLBs
 /** We use 0-1GiB as kernel memory. This will be mapped into all processes.
  * We exclude the first page table so we can use it freely for VM86. */
 static vmm_domain_t kernel_domain = {.start = (void*) 0x400000,
@@ -54,6 +69,47 @@ static vmm_domain_t user_domain = {.start = (void*) 0x40000000,
     .end = (void*) 0xFFFFFFFF - ENTRIES * PAGE_SIZE};
 static uint8_t domain_check_enabled = 0; ///< whether domain checking is performed
 
+/**
+ * Takes the VMM lock with interrupts disabled. If this CPU already holds the
+ * lock, only the depth is counted.
+ */
+static void vmm_lock() {
+    uint8_t interrupts = spinlock_save_interrupts();
+    uint32_t cpu = smp_get_cpu()->id;
+    if (lock_depth && lock_cpu == cpu) { // only we can set lock_cpu to our ID
+        lock_depth++;
+        return;
+    }
+    spinlock_lock(&lock);
+    lock_cpu = cpu;
+    lock_depth = 1;
+    lock_interrupts = interrupts;
+}
+
+/**
+ * Makes the other CPUs flush the pages unmapped so far from their TLBs. This
+ * CPU has already flushed them. The caller needs to hold the VMM lock.
+ */
+static void vmm_shootdown() {
+    if (flush_cpus)
+        mmu_shootdown_tlb(flush_cpus, flush_addresses, flush_count);
+    flush_cpus = flush_count = 0;
+}
+
+/**
+ * Releases the VMM lock if this was the outermost vmm_lock() and restores the
+ * interrupt flag. Pending TLB shootdowns are sent before.
+ */
+static void vmm_unlock() {
+    if (--lock_depth)
+        return;
+    vmm_shootdown();
+    uint8_t interrupts = lock_interrupts;
+    lock_cpu = -1;
+    spinlock_unlock(&lock);
+    spinlock_restore_interrupts(interrupts);
+}
+
 /**
  * Destroys a page table in the current page directory.
  * @param page_table the index of the page table to destroy
@@ -70,16 +126,18 @@ static void vmm_destroy_page_table(uint16_t page_table) {
  * @return the physical address of the new page directory
  */
 page_directory_t* vmm_create_page_directory() {   
+    vmm_lock();
     page_directory_t* dir_phys = pmm_alloc(PAGE_SIZE, PMM_KERNEL);
     logln("VMM", "Creating page directory at %08x", dir_phys);
     page_directory_t* dir = vmm_map_physical_memory(dir_phys, PAGE_SIZE, VMM_KERNEL);
     memset(dir, 0, PAGE_SIZE);
     /// Maps the last entry to itself, see vmm_init() for a detailed explanation.
     page_directory_entry_t dir_entry = {
-        .pr = 1, .rw = 0, .user = 0, .pt = pmm_get_page(dir_phys, 0)
+        .pr = 1, .rw = 1, .user = 0, .pt = pmm_get_page(dir_phys, 0)
     };
     dir[ENTRIES - 1] = dir_entry;
     vmm_unmap_physical_memory(dir, PAGE_SIZE);
+    vmm_unlock();
     return dir_phys;
 }
 
@@ -89,6 +147,7 @@ page_directory_t* vmm_create_page_directory() {
  */
 void vmm_destroy_page_directory(page_directory_t* dir_phys) {
     logln("VMM", "Destroying page directory at %08x", dir_phys);
+    vmm_lock(); // other CPUs must not see the temporary page_directory
     page_directory_t* old_directory = page_directory;
     page_directory_t* dir = vmm_map_physical_memory(dir_phys, PAGE_SIZE, VMM_KERNEL);
     page_directory = dir; /// Operates on the directory we want to destroy.
@@ -102,6 +161,7 @@ void vmm_destroy_page_directory(page_directory_t* dir_phys) {
     vmm_destroy_page_table(ENTRIES - 1); /// Frees the page directory itself.
     page_directory = old_directory; // change back so we can unmap the
     vmm_unmap_physical_memory(dir, PAGE_SIZE); // destroyed directory
+    vmm_unlock();
 }
 
 /**
@@ -129,6 +189,7 @@ static void vmm_refresh_page_directory(page_directory_t* dir_phys) {
 page_directory_t* vmm_load_page_directory(page_directory_t* new_directory) {
     if (new_directory != VMM_PAGEDIR) {
         logln("VMM", "Loading page directory at %08x", new_directory);
+        vmm_lock();
         page_directory_t* old_directory = vmm_get_physical_address(page_directory);
         if (mmu_get_paging()) {
             vmm_refresh_page_directory(new_directory);
@@ -136,23 +197,35 @@ page_directory_t* vmm_load_page_directory(page_directory_t* new_directory) {
         } else
             mmu_enable_paging(new_directory);
         page_directory = VMM_PAGEDIR;
+        smp_get_cpu()->page_directory = new_directory; // for TLB shootdowns
+        vmm_unlock();
         return old_directory;
     }
     return 0;
 }
 
 /**
- * Loads a page directory for temporary modification. Disables interrupts until
- * vmm_modified_page_directory() is called.
+ * Returns the page directory set up by vmm_init(). It is never destroyed and
+ * may be shared by all kernel threads.
+ * @return the physical address of the kernel page directory
+ */
+page_directory_t* vmm_get_kernel_page_directory() {
+    return kernel_directory;
+}
+
+/**
+ * Loads a page directory for temporary modification. Holds the VMM lock (and
+ * so disables interrupts) until vmm_modified_page_directory() is called.
  * @param new_directory the physical address of the page directory to be modified
  */
 void vmm_modify_page_directory(page_directory_t* new_directory) {
+    // we don't want to be interrupted when modifying kernel-relevant
+    vmm_lock(); // page directories
     if (old_directory) {
         println("VMM: Already modifying a page directory at %08x", old_directory);
+        vmm_unlock();
         return;
     }
-    // we don't want to be interrupted when modifying kernel-relevant
-    old_interrupts = isr_enable_interrupts(0); // page directories
     old_directory = vmm_load_page_directory(new_directory);
 }
 
@@ -168,7 +241,7 @@ void vmm_modified_page_directory() {
     }
     vmm_load_page_directory(old_directory);
     old_directory = 0;
-    isr_enable_interrupts(old_interrupts);
+    vmm_unlock();
 }
 
 /**
@@ -198,6 +271,21 @@ static page_table_entry_t* vmm_get_page_table_entry(
     return vmm_get_page_table(dir_entry, vaddr) + vaddr.bits.page;
 }
 
+/**
+ * Creates an empty page table for a page directory entry.
+ * @param dir_entry the page directory entry for the new page table
+ * @param vaddr     a virtual address belonging to the new page table
+ */
+static void vmm_create_page_table(page_directory_entry_t* dir_entry,
+        vmm_virtual_address_t vaddr) {
+    // We assume the table's pages to be writable and in userspace for now,
+    // this is overridden by individual pages.
+    dir_entry->pr = dir_entry->rw = dir_entry->user = 1;
+    dir_entry->pt = pmm_get_page(pmm_alloc(PAGE_SIZE, PMM_KERNEL), 0);
+    page_table_t* tab = vmm_get_page_table(dir_entry, vaddr);
+    memset(tab, 0, PAGE_SIZE); // initialize with zeroes
+}
+
 /**
  * Extracts a domain from the given flags.
  * @param flags the flags containing a domain
@@ -243,6 +331,25 @@ static uint8_t vmm_domain_check(void* vaddr, vmm_flags_t flags) {
     return 1;
 }
 
+/**
+ * Flushes a page from this CPU's TLB and remembers it for the other CPUs that
+ * might have cached it, see vmm_shootdown(). The caller needs to hold the VMM
+ * lock.
+ * @param vaddr the virtual address of the page to flush
+ */
+static void vmm_flush_tlb(void* vaddr) {
+    mmu_flush_tlb(vaddr);
+    uint8_t shared = vmm_is_in_domain(vaddr, &kernel_domain);
+    void* dir = smp_get_cpu()->page_directory;
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++)
+        if (shared || smp_get_cpu_by_id(i)->page_directory == dir)
+            flush_cpus |= 1 << i;
+    if (flush_count < MMU_SHOOTDOWN_BATCH)
+        flush_addresses[flush_count++] = vaddr;
+    else
+        flush_count = MMU_FLUSH_ALL;
+}
+
 /**
  * Maps the given page into memory.
  * @param _vaddr a virtual address in the page to map from
@@ -252,29 +359,30 @@ static uint8_t vmm_domain_check(void* vaddr, vmm_flags_t flags) {
  */
 uint8_t vmm_map(void* _vaddr, void* paddr, vmm_flags_t flags) {
     if (!vmm_domain_check(_vaddr, flags)) return 0;
+    vmm_lock();
     vmm_virtual_address_t vaddr = (vmm_virtual_address_t) _vaddr;
     /// Finds the page directory entry associated with this page.
     page_directory_entry_t* dir_entry = page_directory + vaddr.bits.page_table;
-    if (!dir_entry->pr) { /// If the table doesn't exist yet, creates it.
-        // We assume the table's pages to be writable and in userspace for now,
-        // this is overridden by individual pages below.
-        dir_entry->pr = dir_entry->rw = dir_entry->user = 1;
-        dir_entry->pt = pmm_get_page(pmm_alloc(PAGE_SIZE, PMM_KERNEL), 0);
-        page_table_t* tab = vmm_get_page_table(dir_entry, vaddr);
-        memset(tab, 0, PAGE_SIZE); // initialize with zeroes
-    }
+    if (!dir_entry->pr) /// If the table doesn't exist yet, creates it.
+        vmm_create_page_table(dir_entry, vaddr);
     page_table_entry_t* tab_entry = vmm_get_page_table_entry(dir_entry, vaddr);
     if (tab_entry->pr) {
         println("%4aVMM: %08x is already mapped%a", vaddr);
+        vmm_unlock();
         return 0; /// If we already mapped this page, cancels and returns 0.
     }
     tab_entry->pr = 1;
-    tab_entry->rw = !!(flags & VMM_WRITABLE);
+    /// Kernel pages are always writable. The kernel respects read-only user
+    /// pages (see mmu_enable_paging()), so they may be shared between tasks.
+    tab_entry->rw = !(flags & VMM_USER) || (flags & VMM_WRITABLE);
     tab_entry->user = flags & VMM_USER;
+    tab_entry->cache = !!(flags & VMM_UNCACHED);
     tab_entry->page = pmm_get_page(paddr, 0); /// Otherwise, maps the page.
     /// if we changed the current directory, flushes the TLB to apply changes.
+    /// Other CPUs need no shootdown, TLBs do not cache non-present pages.
     if (page_directory == VMM_PAGEDIR)
         mmu_flush_tlb(_vaddr);
+    vmm_unlock();
     return 1;
 }
 
@@ -285,22 +393,32 @@ uint8_t vmm_map(void* _vaddr, void* paddr, vmm_flags_t flags) {
  */
 void vmm_unmap(void* _vaddr) {
     vmm_virtual_address_t vaddr = (vmm_virtual_address_t) _vaddr;
+    vmm_lock();
     page_directory_entry_t* dir_entry = page_directory + vaddr.bits.page_table;
-    if (!dir_entry->pr) /// if the page table doesn't exist yet, does nothing.
+    if (!dir_entry->pr) { /// if the page table doesn't exist yet, does nothing.
+        vmm_unlock();
         return;
+    }
     page_table_t* page_table = vmm_get_page_table(dir_entry, vaddr);
     page_table_entry_t* tab_entry = page_table + vaddr.bits.page;
-    if (!tab_entry->pr)
+    if (!tab_entry->pr) {
+        vmm_unlock();
         return; /// If the page was not yet mapped, does nothing.
+    }
     memset(tab_entry, 0, sizeof(page_table_entry_t)); /// Removes the mapping.
+    if (page_directory == VMM_PAGEDIR)
+        vmm_flush_tlb(_vaddr);
     int i;
     for (i = 0; i < ENTRIES; i++)
         if (page_table[i].pr) /// Searches the page table for other present entries.
             break;
-    if (i == ENTRIES - 1) /// If there are none, the page table is freed.
+    /// If there are none, the page table is freed (except for kernel page
+    /// tables which are shared, see vmm_init()). No CPU may still use it then.
+    if (i == ENTRIES && !vmm_is_in_domain(_vaddr, &kernel_domain)) {
+        vmm_shootdown();
         vmm_destroy_page_table(vaddr.bits.page_table);
-    if (page_directory == VMM_PAGEDIR)
-        mmu_flush_tlb(_vaddr);
+    }
+    vmm_unlock();
 }
 
 /**
@@ -340,7 +458,9 @@ static void vmm_map_range_detailed(void* vaddr, void* paddr, size_t len,
  */
 void vmm_map_range(void* vaddr, void* paddr, size_t len, vmm_flags_t flags) {
     if (len == 0) return;
+    vmm_lock();
     vmm_map_range_detailed(vaddr, paddr, len, flags, 1);
+    vmm_unlock();
 }
 
 /**
@@ -351,7 +471,9 @@ void vmm_map_range(void* vaddr, void* paddr, size_t len, vmm_flags_t flags) {
  */
 void vmm_unmap_range(void* vaddr, size_t len) {
     if (len == 0) return;
+    vmm_lock();
     vmm_map_range_detailed(vaddr, 0, len, 0, 0);
+    vmm_unlock();
 }
 
 /**
@@ -363,19 +485,51 @@ void* vmm_get_physical_address(void* _vaddr) {
     if (!mmu_get_paging())
         return _vaddr;
     vmm_virtual_address_t vaddr = (vmm_virtual_address_t) _vaddr;
+    void* paddr = 0;
+    vmm_lock();
     page_directory_entry_t* dir_entry = page_directory + vaddr.bits.page_table;
-    if (!dir_entry->pr)
-        return 0; // this virtual address is not currently mapped
-    page_table_entry_t* tab_entry = vmm_get_page_table_entry(dir_entry, vaddr);
-    if (!tab_entry->pr)
+    if (dir_entry->pr) { // otherwise this virtual address is not currently mapped
+        page_table_entry_t* tab_entry = vmm_get_page_table_entry(dir_entry, vaddr);
+        if (tab_entry->pr)
+            paddr = pmm_get_address(tab_entry->page, vaddr.bits.page_offset);
+    }
+    vmm_unlock();
+    return paddr;
+}
+
+/**
+ * Checks whether user space may access a memory range, so syscalls can
+ * validate a user buffer once before working with it.
+ * @param vaddr the range's start
+ * @param len   the range's length in bytes
+ * @param flags VMM_WRITABLE if the kernel is going to write to the range
+ * @return whether the range is mapped in the user domain (and writable)
+ */
+uint8_t vmm_check_user_memory(void* vaddr, size_t len, vmm_flags_t flags) {
+    uintptr_t start = (uintptr_t) vaddr, end = start + len - 1;
+    if (!len || end < start || !vmm_is_in_domain(vaddr, &user_domain) ||
+            !vmm_is_in_domain((void*) end, &user_domain))
         return 0;
-    return pmm_get_address(tab_entry->page, vaddr.bits.page_offset);
+    uint8_t accessible = 1;
+    vmm_lock();
+    for (uintptr_t page = start & ~(PAGE_SIZE - 1); accessible && page <= end;
+            page += PAGE_SIZE) {
+        vmm_virtual_address_t addr = (vmm_virtual_address_t) (void*) page;
+        page_directory_entry_t* dir_entry = page_directory + addr.bits.page_table;
+        page_table_entry_t* tab_entry;
+        accessible = dir_entry->pr && (tab_entry =
+                vmm_get_page_table_entry(dir_entry, addr))->pr && tab_entry->user &&
+                (tab_entry->rw || !(flags & VMM_WRITABLE));
+    }
+    vmm_unlock();
+    return accessible;
 }
 
 /**
  * Dumps the current page directory. The dump is logged.
  */
 void vmm_dump() {
+    vmm_lock();
     log("VMM", "Page directory at %08x (physical %08x):",
             page_directory, vmm_get_physical_address(page_directory));
     uint32_t logged = 0;
@@ -396,6 +550,8 @@ void vmm_dump() {
         }
     }
     logln(0, "");
+    vmm_unlock();
+    spinlock_dump(&lock);
 }
 
 /**
@@ -440,10 +596,11 @@ static pmm_flags_t vmm_get_pmm_flags(vmm_flags_t flags) {
 void* vmm_map_physical_memory(void* paddr, size_t len, vmm_flags_t flags) {
     if (!mmu_get_paging())
         return paddr;
+    vmm_lock(); // nobody may take the free pages before we map them
     void* vaddr = vmm_find_free(len, vmm_get_domain(flags));
-    if (!vaddr)
-        return 0;
-    vmm_map_range(vaddr, paddr, len, flags);
+    if (vaddr)
+        vmm_map_range(vaddr, paddr, len, flags);
+    vmm_unlock();
     return vaddr;
 }
 
@@ -479,10 +636,11 @@ void vmm_use(void* vaddr, void* paddr, size_t len, vmm_flags_t flags) {
  * @return the virtual address of the newly mapped memory
  */
 void* vmm_use_physical_memory(void* paddr, size_t len, vmm_flags_t flags) {
+    vmm_lock();
     void* vaddr = vmm_find_free(len, vmm_get_domain(flags));
-    if (!vaddr)
-        return 0;
-    vmm_use(vaddr, paddr, len, flags);
+    if (vaddr)
+        vmm_use(vaddr, paddr, len, flags);
+    vmm_unlock();
     return vaddr;
 }
 
@@ -496,9 +654,8 @@ void* vmm_use_physical_memory(void* paddr, size_t len, vmm_flags_t flags) {
 void* vmm_use_virtual_memory(void* vaddr, size_t len, vmm_flags_t flags) {
     if (!vmm_domain_check(vaddr, flags)) return 0;
     void* paddr = pmm_alloc(len, vmm_get_pmm_flags(flags));
-    if (!paddr)
-        return 0;
-    vmm_map_range(vaddr, paddr, len, flags);
+    if (paddr)
+        vmm_map_range(vaddr, paddr, len, flags);
     return paddr;
 }
 
@@ -512,11 +669,12 @@ void* vmm_alloc(size_t len, vmm_flags_t flags) {
     // Allocate some memory and find unmapped virtual space to map it into.
     // Note that this does not necessarily identity-map!
     void* paddr = pmm_alloc(len, vmm_get_pmm_flags(flags));
+    vmm_lock(); // nobody may take the free pages before we map them
     void* vaddr = vmm_find_free(len, vmm_get_domain(flags));
-    if (!paddr || !vaddr)
-        return 0;
-    vmm_map_range(vaddr, paddr, len, flags);
-    return vaddr;
+    if (paddr && vaddr)
+        vmm_map_range(vaddr, paddr, len, flags);
+    vmm_unlock();
+    return paddr ? vaddr : 0;
 }
 
 /**
@@ -527,8 +685,11 @@ void* vmm_alloc(size_t len, vmm_flags_t flags) {
  */
 void vmm_free(void* vaddr, size_t len) {
     if (len == 0) return;
+    vmm_lock();
     void* paddr = vmm_get_physical_address(vaddr);
     vmm_unmap_range(vaddr, len);
+    vmm_shootdown(); // no CPU may access the pages once they are free
+    vmm_unlock();
     pmm_free(paddr, len);
 }
 
@@ -544,7 +705,7 @@ void vmm_enable_domain_check(uint8_t enable) {
 void vmm_init() {
     print("VMM init ... ");
     mmu_init();
-    page_directory = vmm_create_page_directory();
+    page_directory = kernel_directory = vmm_create_page_directory();
     /// Identity maps all up to now used kernel pages. The PMM has memorized up
     /// to which page we need to map at most to speed up the process.
     uint32_t highest_kernel_page = pmm_get_highest_kernel_page();
@@ -590,6 +751,17 @@ void vmm_init() {
     /// - 0xFFFFF000 - the page directory, see VMM_PAGEDIR()
     ///
     /// In this way, we can map addresses as we like even with paging enabled.
+    /// Creates all kernel page tables now. Every page directory shares them,
+    /// so the kernel's page directory entries never change afterwards. This is
+    /// needed with multiple CPUs because one CPU cannot see new page directory
+    /// entries another CPU creates in its own page directory.
+    vmm_virtual_address_t start = (vmm_virtual_address_t) kernel_domain.start,
+            end = (vmm_virtual_address_t) kernel_domain.end;
+    for (vmm_virtual_address_t vaddr = start;
+            vaddr.bits.page_table <= end.bits.page_table;
+            vaddr.ptr = (uint8_t*) vaddr.ptr + ENTRIES * PAGE_SIZE)
+        if (!page_directory[vaddr.bits.page_table].pr)
+            vmm_create_page_table(page_directory + vaddr.bits.page_table, vaddr);
     io_use_video_memory(); /// Maps video memory in order to keep print working.
     println("%2aok%a.");
 }
@@ -16,9 +16,10 @@
 #define VMM_PAGETAB(i) ((page_table_t*) (0xFFC00000 + (i) * PAGE_SIZE))
 
 /** Whether we are working with kernel or user memory. This controls
- * permissions and in which domain memory is stored. */
+ * permissions and in which domain memory is stored. Memory-mapped devices
+ * (like the local APIC) need to be mapped uncached. */
 typedef enum {
-    VMM_KERNEL = 0b0, VMM_USER = 0b1, VMM_WRITABLE = 0b100
+    VMM_KERNEL = 0b0, VMM_USER = 0b1, VMM_WRITABLE = 0b100, VMM_UNCACHED = 0b1000
 } vmm_flags_t;
 
 /** An entry in a page directory. This describes a page table. */
@@ -58,6 +59,7 @@ typedef page_table_entry_t page_table_t;
 page_directory_t* vmm_create_page_directory();
 void vmm_destroy_page_directory(page_directory_t* dir_phys);
 page_directory_t* vmm_load_page_directory(page_directory_t* new_directory);
+page_directory_t* vmm_get_kernel_page_directory();
 void vmm_modify_page_directory(page_directory_t* new_directory);
 void vmm_modified_page_directory();
 uint8_t vmm_map(void* _vaddr, void* paddr, vmm_flags_t flags);
@@ -65,6 +67,7 @@ void vmm_unmap(void* _vaddr);
 void vmm_map_range(void* vaddr, void* paddr, size_t len, vmm_flags_t flags);
 void vmm_unmap_range(void* vaddr, size_t len);
 void* vmm_get_physical_address(void* _vaddr);
+uint8_t vmm_check_user_memory(void* vaddr, size_t len, vmm_flags_t flags);
 void vmm_dump();
 void* vmm_map_physical_memory(void* paddr, size_t len, vmm_flags_t flags);
 void vmm_unmap_physical_memory(void* vaddr, size_t len);
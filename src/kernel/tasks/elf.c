@@ -5,6 +5,8 @@
  * Executable and Linking Format
  * 
  * ELF files are used to execute external programs in user space.
+ * Read-only segments (like code) are loaded only once per ELF file and shared
+ * by all tasks running it. Only writable segments are copied for every task.
  * @see https://en.wikipedia.org/wiki/Executable_and_Linkable_Format
  * @see http://wiki.osdev.org/ELF
  * @see http://lowlevel.eu/wiki/ELF
@@ -15,12 +17,15 @@
 #include <string.h>
 #include <tasks/elf.h>
 #include <interrupts/isr.h>
+#include <lib/spinlock.h>
 
 #define MAGIC_0 0x7F ///< magic value expected at the beginning of an ELF file
 #define MAGIC_1 'E'  ///< magic value expected at the beginning of an ELF file
 #define MAGIC_2 'L'  ///< magic value expected at the beginning of an ELF file
 #define MAGIC_3 'F'  ///< magic value expected at the beginning of an ELF file
 #define VERSION 1    ///< only ELF version 1 is supported (the current version)
+#define MAX_SHARED_SEGMENTS 64 ///< how many read-only segments may be shared
+#define PAGE_SIZE 0x1000 ///< shared segments need to be page-aligned
 
 /// 32 or 64 bit
 enum elf_class   { CLASS_32_BIT = 1, CLASS_64_BIT };
@@ -48,6 +53,69 @@ typedef struct {
     uint32_t p_align;  ///< how this segment is aligned
 } __attribute__((packed)) elf_program_header_entry_t;
 
+/// a read-only segment whose physical memory is shared by multiple tasks
+typedef struct {
+    elf_t* elf;          ///< the ELF file the segment belongs to (0 if unused)
+    uint32_t index;      ///< the segment's index in the program header table
+    void* paddr;         ///< where the segment is located in physical memory
+    uint32_t references; ///< how many page directories map the segment
+} elf_shared_segment_t;
+
+/** Table of shared segments. Fixed-size array for now, like the task list. */
+static elf_shared_segment_t shared_segments[MAX_SHARED_SEGMENTS];
+/** Protects the shared segments while ELF files are loaded or unloaded. */
+static spinlock_t lock = SPINLOCK_INIT("ELF");
+
+/**
+ * Returns whether a segment has its pages to itself, that is, no other
+ * loadable segment uses any of them.
+ * @param elf   the ELF file
+ * @param index the segment's index in the program header table
+ * @return whether the segment's pages are its own
+ */
+static uint8_t elf_owns_pages(elf_t* elf, uint32_t index) {
+    elf_program_header_entry_t* program_header_table =
+            (elf_program_header_entry_t*) ((uintptr_t) elf + elf->e_phoff);
+    elf_program_header_entry_t* entry = program_header_table + index;
+    uintptr_t start = (uintptr_t) entry->p_vaddr & ~(PAGE_SIZE - 1),
+            end = (uintptr_t) entry->p_vaddr + entry->p_memsz;
+    for (int i = 0; i < elf->e_phnum; i++) {
+        elf_program_header_entry_t* other = program_header_table + i;
+        uintptr_t other_start = (uintptr_t) other->p_vaddr & ~(PAGE_SIZE - 1);
+        if (i != index && other->p_type == PT_LOAD && other_start < end &&
+                start < (uintptr_t) other->p_vaddr + other->p_memsz)
+            return 0; // the other segment touches one of our pages
+    }
+    return 1;
+}
+
+/**
+ * Returns whether a segment may be shared. This is the case for read-only
+ * segments that have their pages to themselves, otherwise loading another
+ * segment would write to the shared memory.
+ * @param elf   the ELF file
+ * @param index the segment's index in the program header table
+ * @return whether the segment may be shared
+ */
+static uint8_t elf_is_shareable(elf_t* elf, uint32_t index) {
+    elf_program_header_entry_t* entry = (elf_program_header_entry_t*)
+            ((uintptr_t) elf + elf->e_phoff) + index;
+    return !(entry->p_flags & PF_W) && elf_owns_pages(elf, index);
+}
+
+/**
+ * Finds a shared segment.
+ * @param elf   the ELF file the segment belongs to, if 0 finds an unused entry
+ * @param index the segment's index in the program header table
+ * @return the shared segment or 0 if not found
+ */
+static elf_shared_segment_t* elf_find_shared_segment(elf_t* elf, uint32_t index) {
+    for (int i = 0; i < MAX_SHARED_SEGMENTS; i++)
+        if (shared_segments[i].elf == elf && (!elf || shared_segments[i].index == index))
+            return shared_segments + i;
+    return 0;
+}
+
 /**
  * Checks whether a pointer points to a valid ELF file for this OS.
  * @param elf the start address of the ELF file in memory
@@ -95,6 +163,7 @@ void* elf_load(elf_t* elf, page_directory_t* page_directory) {
     elf_program_header_entry_t* program_header_table =
             (elf_program_header_entry_t*) ((uintptr_t) elf + elf->e_phoff);
     logln("ELF", "Program header entries:");
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
     vmm_modify_page_directory(page_directory);
     for (int i = 0; i < elf->e_phnum; i++) { // process every entry in the table
         elf_program_header_entry_t* entry = program_header_table + i;
@@ -102,20 +171,47 @@ void* elf_load(elf_t* elf, page_directory_t* page_directory) {
                 "filesz=%08x memsz=%08x flags=%03b align=%08x", i,
                 entry->p_type, entry->p_offset, entry->p_vaddr, entry->p_paddr,
                 entry->p_filesz, entry->p_memsz, entry->p_flags, entry->p_align);
-        if (entry->p_type == PT_LOAD)  { // we only process LOAD segments for now
-            // claim the memory so that we can write to it
-            vmm_use_virtual_memory(entry->p_vaddr, entry->p_memsz,
-                    entry->p_flags & PF_W ? VMM_USER | VMM_WRITABLE : VMM_USER);
-            // Fill the complete segment with zeroes. (There are cases when the
-            // segment's p_memsz is bigger than p_filesz, for example for BSS
-            // sections which need to be initialized with zeroes.)
-            memset(entry->p_vaddr, 0, entry->p_memsz);
-            // Now copy the actual segment's data from the file to memory.
-            memcpy(entry->p_vaddr, (void*) ((uintptr_t) elf + entry->p_offset),
-                    entry->p_filesz);
+        if (entry->p_type != PT_LOAD) // we only process LOAD segments for now
+            continue;
+        elf_shared_segment_t* shared = 0;
+        if (elf_is_shareable(elf, i)) {
+            // If another task already loaded this read-only segment, we just
+            // map its physical memory.
+            if ((shared = elf_find_shared_segment(elf, i))) {
+                vmm_map_range(entry->p_vaddr, shared->paddr, entry->p_memsz, VMM_USER);
+                shared->references++;
+                continue;
+            }
+            // Otherwise we load it and remember it for the next task.
+            if (!(shared = elf_find_shared_segment(0, 0)))
+                println("%4aToo many shared segments, copying instead%a");
+        }
+        // Claim the memory so that we can write to it. The kernel respects
+        // read-only pages (see mmu_enable_paging()), so we write protect a
+        // read-only segment afterwards. That's only possible if it has its
+        // pages to itself, another segment might still need to write to them.
+        void* paddr = vmm_use_virtual_memory(entry->p_vaddr, entry->p_memsz,
+                VMM_USER | VMM_WRITABLE);
+        // Fill the complete segment with zeroes. (There are cases when the
+        // segment's p_memsz is bigger than p_filesz, for example for BSS
+        // sections which need to be initialized with zeroes.)
+        memset(entry->p_vaddr, 0, entry->p_memsz);
+        // Now copy the actual segment's data from the file to memory.
+        memcpy(entry->p_vaddr, (void*) ((uintptr_t) elf + entry->p_offset),
+                entry->p_filesz);
+        if (elf_is_shareable(elf, i)) {
+            vmm_unmap_range(entry->p_vaddr, entry->p_memsz);
+            vmm_map_range(entry->p_vaddr, paddr, entry->p_memsz, VMM_USER);
+        }
+        if (shared) {
+            shared->elf = elf;
+            shared->index = i;
+            shared->paddr = paddr;
+            shared->references = 1;
         }
     }
     vmm_modified_page_directory();
+    spinlock_unlock_irqrestore(&lock, interrupts);
     return elf->e_entry;
 }
 
@@ -129,13 +225,27 @@ void elf_unload(elf_t* elf, page_directory_t* page_directory) {
         return;
     elf_program_header_entry_t* program_header_table =
             (elf_program_header_entry_t*) ((uintptr_t) elf + elf->e_phoff);
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
     vmm_modify_page_directory(page_directory);
     for (int i = 0; i < elf->e_phnum; i++) {
         elf_program_header_entry_t* entry = program_header_table + i;
-        if (entry->p_type == PT_LOAD)
+        if (entry->p_type != PT_LOAD)
+            continue;
+        elf_shared_segment_t* shared = elf_find_shared_segment(elf, i);
+        // The segment might have been registered after this task copied it
+        // (because the table was full), so we check what this task mapped.
+        if (shared && vmm_get_physical_address(entry->p_vaddr) == shared->paddr) {
+            // Shared segments are only freed when the last task unloads them.
+            vmm_unmap_range(entry->p_vaddr, entry->p_memsz);
+            if (--shared->references == 0) {
+                pmm_free(shared->paddr, entry->p_memsz);
+                shared->elf = 0;
+            }
+        } else
             vmm_free(entry->p_vaddr, entry->p_memsz);
     }
     vmm_modified_page_directory();
+    spinlock_unlock_irqrestore(&lock, interrupts);
 }
 
 /**
@@ -151,23 +261,22 @@ task_pid_t elf_create_task(elf_t* elf, size_t kernel_stack_len,
         println("%4aELF not found%a");
         return 0;
     }
-    uint8_t old_interrupts = isr_enable_interrupts(0);
     page_directory_t* dir = vmm_create_page_directory();
-    task_pid_t pid = task_create_user(elf_load(elf, dir), dir,
+    return task_create_user(elf_load(elf, dir), dir,
             kernel_stack_len, user_stack_len, elf);
-    isr_enable_interrupts(old_interrupts);
-    return pid;
 }
 
 /**
- * Destroys a user task running the code of an ELF file.
+ * Releases a stopped user task running the code of an ELF file. The ELF file
+ * is only unloaded when the last thread using it is released. Like
+ * task_release(), this is only called by the reaper.
  * @param pid PID of the ELF task
+ * @see task_release
  */
-void elf_destroy_task(task_pid_t pid) {
-    uint8_t old_interrupts = isr_enable_interrupts(0);
-    elf_unload(task_get_elf(pid), task_get_page_directory(pid));
-    task_destroy(pid);
-    isr_enable_interrupts(old_interrupts);
+void elf_release_task(task_pid_t pid) {
+    if (!task_shares_page_directory(pid))
+        elf_unload(task_get_elf(pid), task_get_page_directory(pid));
+    task_release(pid);
 }
 
 /// @}
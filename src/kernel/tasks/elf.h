@@ -43,7 +43,7 @@ typedef struct {
 typedef elf_header_t elf_t; ///< an ELF file starts with the header
 
 task_pid_t elf_create_task(elf_t* elf, size_t kernel_stack_len, size_t user_stack_len);
-void elf_destroy_task(task_pid_t pid);
+void elf_release_task(task_pid_t pid);
 
 #endif
 
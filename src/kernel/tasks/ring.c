@@ -0,0 +1,214 @@
+/**
+ * @file
+ * @addtogroup ring
+ * @{
+ * Submission/Completion Ring
+ * 
+ * A task that issues many small requests may queue them in a ring instead of
+ * trapping for each one. The ring is a page mapped into the task's address
+ * space and into the kernel domain, so completions can be posted while
+ * another address space is loaded (e.g. by a timer) and the task consumes
+ * them without a syscall. sys_ring_enter() hands all queued entries to the
+ * kernel at once and optionally blocks until enough completions are ready.
+ * Everything the kernel relies on (how far it consumed, what is in flight,
+ * pending timers) is kept in a separate structure user space can't touch.
+ * Rings are only used in syscalls and timer callbacks, so the kernel lock
+ * protects them.
+ * @see http://kernel.dk/io_uring.pdf
+ */
+
+#include <common.h>
+#include <tasks/ring.h>
+#include <tasks/schedule.h>
+#include <tasks/timer.h>
+#include <tasks/wait.h>
+#include <interrupts/syscall.h>
+#include <hardware/pit.h>
+#include <mem/vmm.h>
+#include <syscall.h>
+#include <string.h>
+
+struct ring_kernel;
+
+/// a RING_TIMEOUT in flight
+typedef struct {
+    timer_t timer;              ///< fires when the timeout expires
+    uint32_t user_data;         ///< copied into the completion
+    struct ring_kernel* kring;  ///< the ring the timeout belongs to
+    uint8_t pending;            ///< whether the timer is running
+} ring_timeout_t;
+
+/// the kernel's view of a task's ring
+typedef struct ring_kernel {
+    ring_t* ring;          ///< the shared page, mapped into the kernel domain
+    ring_t* user_ring;     ///< the shared page in the task's address space
+    uint32_t sq_head;      ///< the next submission to consume
+    uint32_t cq_tail;      ///< where the next completion goes
+    uint32_t inflight;     ///< submissions that have not completed yet
+    wait_queue_t waiters;  ///< the task, if it waits for completions
+    ring_timeout_t timeouts[RING_ENTRIES]; ///< one slot per entry that may be in flight
+} ring_kernel_t;
+
+/**
+ * Appends a completion to a ring and wakes up the task if it is waiting.
+ * There is always room because ring_enter() never has more entries in flight
+ * than there are free completion entries.
+ * @param kring     the ring
+ * @param user_data from the submission
+ * @param result    the operation's return value
+ */
+static void ring_complete(ring_kernel_t* kring, uint32_t user_data, uint32_t result) {
+    ring_cqe_t* cqe = &kring->ring->cq[kring->cq_tail % RING_ENTRIES];
+    cqe->user_data = user_data;
+    cqe->result = result;
+    asm volatile("" : : : "memory"); /// The entry is written before the tail moves.
+    kring->ring->cq_tail = ++kring->cq_tail;
+    kring->inflight--;
+    wait_wake_all(&kring->waiters);
+}
+
+/**
+ * Completes a timeout. Called by the timer queue.
+ * @param data the timeout
+ */
+static void ring_timeout(void* data) {
+    ring_timeout_t* timeout = data;
+    timeout->pending = 0;
+    ring_complete(timeout->kring, timeout->user_data, 0);
+}
+
+/**
+ * Finds a timeout slot whose timer is not running. Slots can't be picked by
+ * submission index, a long timeout may still be pending when its index comes
+ * around again.
+ * @param kring the ring
+ * @return the slot or 0 if all timers are running
+ */
+static ring_timeout_t* ring_get_free_timeout(ring_kernel_t* kring) {
+    for (uint32_t i = 0; i < RING_ENTRIES; i++)
+        if (!kring->timeouts[i].pending)
+            return kring->timeouts + i;
+    return 0;
+}
+
+/**
+ * Starts an operation. Most operations complete right away.
+ * @param kring the ring
+ * @param sqe   a copy of the submission, so user space can't change it meanwhile
+ */
+static void ring_start(ring_kernel_t* kring, ring_sqe_t* sqe) {
+    switch (sqe->op) {
+        case RING_NOP:
+            ring_complete(kring, sqe->user_data, 0);
+            break;
+        case RING_WRITE:
+            ring_complete(kring, sqe->user_data,
+                    syscall_write(sqe->arg[0], (char*) sqe->arg[1], sqe->arg[2]));
+            break;
+        case RING_TIMEOUT: {
+            uint32_t ticks = pit_ms_to_ticks(sqe->arg[0]);
+            ring_timeout_t* timeout;
+            if (!ticks) {
+                ring_complete(kring, sqe->user_data, 0);
+                break;
+            }
+            if (!(timeout = ring_get_free_timeout(kring))) {
+                ring_complete(kring, sqe->user_data, -1);
+                break;
+            }
+            timeout->user_data = sqe->user_data;
+            timeout->kring = kring;
+            timeout->pending = 1;
+            timer_add(&timeout->timer, ticks, ring_timeout, timeout);
+            break;
+        }
+        default:
+            ring_complete(kring, sqe->user_data, -1);
+    }
+}
+
+/**
+ * Creates the current task's ring. A task has at most one ring.
+ * @return the ring in the task's address space, or 0 on error
+ */
+ring_t* ring_setup() {
+    task_pid_t pid = schedule_get_current_task();
+    ring_kernel_t* kring = task_get_ring(pid);
+    if (kring)
+        return kring->user_ring;
+    if (task_get_page_directory(pid) == vmm_get_kernel_page_directory())
+        return 0; // kernel threads have no user address space
+
+    if (!(kring = vmm_alloc(sizeof(ring_kernel_t), VMM_KERNEL)))
+        return 0;
+    memset(kring, 0, sizeof(ring_kernel_t));
+    if (!(kring->user_ring = vmm_alloc(sizeof(ring_t), VMM_USER | VMM_WRITABLE))) {
+        vmm_free(kring, sizeof(ring_kernel_t));
+        return 0;
+    }
+    kring->ring = vmm_map_physical_memory(vmm_get_physical_address(kring->user_ring),
+            sizeof(ring_t), VMM_KERNEL | VMM_WRITABLE);
+    if (!kring->ring) {
+        vmm_free(kring->user_ring, sizeof(ring_t));
+        vmm_free(kring, sizeof(ring_kernel_t));
+        return 0;
+    }
+    memset(kring->ring, 0, sizeof(ring_t));
+    task_set_ring(pid, kring);
+    return kring->user_ring;
+}
+
+/**
+ * Starts the submissions in the current task's ring and possibly waits for
+ * completions.
+ * @param to_submit    how many submissions to start at most
+ * @param min_complete block until this many completions are ready (unless
+ *                     nothing is in flight anymore)
+ * @param cpu          the CPU state pointer so we can switch to the next task
+ * @return the number of completions ready or -1 if there is no ring
+ */
+uint32_t ring_enter(uint32_t to_submit, uint32_t min_complete, cpu_state_t** cpu) {
+    ring_kernel_t* kring = task_get_ring(schedule_get_current_task());
+    if (!kring)
+        return -1;
+    ring_t* ring = kring->ring;
+    /// Submissions are only consumed while their completion is sure to fit,
+    /// the task's cq_head is only trusted to limit this.
+    for (; to_submit && kring->sq_head != ring->sq_tail &&
+            kring->cq_tail - ring->cq_head + kring->inflight < RING_ENTRIES; to_submit--) {
+        ring_sqe_t sqe = ring->sq[kring->sq_head % RING_ENTRIES];
+        kring->inflight++;
+        ring_start(kring, &sqe);
+        ring->sq_head = ++kring->sq_head;
+    }
+    uint32_t ready = kring->cq_tail - ring->cq_head;
+    if (ready >= min_complete || !kring->inflight)
+        return ready;
+    /// Otherwise we block and restart the syscall when a completion wakes us
+    /// up. Submissions are consumed already, so the restart only waits.
+    (*cpu)->eip -= 2;
+    *cpu = wait_sleep(&kring->waiters, *cpu);
+    return SYSCALL_RING_ENTER; // EAX must still hold the ID if we didn't switch
+}
+
+/**
+ * Releases a task's ring, pending timeouts are dropped. The caller needs to
+ * have the task's page directory modified, see task_release().
+ * @param pid the task's PID
+ */
+void ring_release(task_pid_t pid) {
+    uint8_t old_interrupts = isr_enable_interrupts(0); // no timer may fire meanwhile
+    ring_kernel_t* kring = task_get_ring(pid);
+    if (kring)
+        for (uint32_t i = 0; i < RING_ENTRIES; i++)
+            timer_cancel(&kring->timeouts[i].timer);
+    task_set_ring(pid, 0);
+    isr_enable_interrupts(old_interrupts);
+    if (!kring)
+        return;
+    vmm_unmap_physical_memory(kring->ring, sizeof(ring_t));
+    vmm_free(kring->user_ring, sizeof(ring_t));
+    vmm_free(kring, sizeof(ring_kernel_t));
+}
+
+/// @}
@@ -0,0 +1,21 @@
+/**
+ * @file
+ * @addtogroup ring
+ * @{
+ */
+
+#ifndef TASKS_RING_H
+#define TASKS_RING_H
+
+#include <stdint.h>
+#include <interrupts/isr.h>
+#include <tasks/task.h>
+#include <ring.h>
+
+ring_t* ring_setup();
+uint32_t ring_enter(uint32_t to_submit, uint32_t min_complete, cpu_state_t** cpu);
+void ring_release(task_pid_t pid);
+
+#endif
+
+/// @}
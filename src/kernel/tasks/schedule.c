@@ -4,47 +4,553 @@
  * @{
  * Scheduler
  * 
- * The scheduler switches tasks using a simple round robin strategy.
+ * The scheduler switches tasks using a multilevel feedback queue. Every task
+ * sits on one of SCHEDULE_PRIORITIES levels, the task with the highest level
+ * (the lowest number) runs, tasks on the same level take turns round robin.
+ * Lower levels get longer time slices. A task that uses up its whole time
+ * slice is demoted to the next lower level, so CPU hogs sink to the bottom.
+ * A task that gives up the CPU early (because it blocks or yields) is boosted
+ * one level up, so interactive tasks stay on top. A task never rises above its
+ * base priority which can be changed with schedule_set_priority(). To prevent
+ * starvation, all tasks are periodically reset to their base priority.
+ * If no task is runnable, the idle task runs which halts the CPU until the
+ * next interrupt instead of burning cycles.
+ *
+ * Every CPU runs this scheduler on its own timer tick and has its own run
+ * queue and idle task. New tasks join the least loaded run queue and stay
+ * there, so they find their data in that CPU's cache. A CPU that has nothing
+ * to run steals a task from the busiest run queue, and the boot CPU
+ * periodically moves waiting tasks from the busiest to the idlest run queue,
+ * preferring tasks that have not run for the longest time (whose cache is
+ * cold anyway). Tasks can be pinned to some CPUs with schedule_set_affinity().
+ * Real-time tasks are scheduled globally, the released real-time task with
+ * the earliest deadline runs on whatever CPU is scheduling.
+ * The global bookkeeping (boosting, balancing and real-time releases) is only
+ * done on the boot CPU, boosting and balancing by timers on the timer wheel.
+ * The run queues, the real-time class and the statistics are protected by the
+ * scheduler lock which every public entry point takes, schedule_switch_task()
+ * and schedule_get_next_task() expect the caller to hold it.
+ *
+ * An idle CPU stops its tick (see lapic_timer_stop()) so it is not woken up
+ * for nothing. The boot CPU still wakes up for the next timer and its
+ * bookkeeping, the other CPUs sleep until schedule_kick() has a task for them.
+ * While there are real-time tasks, all CPUs keep ticking for the releases.
+ *
+ * Periodic tasks can instead join the real-time class with
+ * schedule_set_realtime(). A real-time task is released every period with a
+ * budget of ticks and always runs ahead of the feedback queue. Among released
+ * tasks, the one with the earliest deadline (the end of its period) runs.
+ * A task's job for the current period ends when its budget is used up or when
+ * it gives up the CPU, then it waits for the next release. Tasks are only
+ * admitted as long as the total utilization (budget / period) stays below
+ * REALTIME_MAX_UTILIZATION, so all deadlines can be met.
  * @see http://wiki.osdev.org/Scheduling_Algorithms
+ * @see http://pages.cs.wisc.edu/~remzi/OSTEP/cpu-sched-mlfq.pdf
+ * @see https://en.wikipedia.org/wiki/Earliest_deadline_first_scheduling
  */
 
 #include <common.h>
 #include <tasks/schedule.h>
 #include <tasks/elf.h>
 #include <tasks/tss.h>
+#include <tasks/timer.h>
+#include <tasks/wait.h>
+#include <hardware/pit.h>
+#include <hardware/cpu/tsc.h>
+#include <hardware/cpu/fpu.h>
+#include <hardware/cpu/smp.h>
+#include <hardware/cpu/lapic.h>
+#include <mem/gdt.h>
 #include <mem/mmu.h>
 #include <mem/vmm.h>
+#include <lib/spinlock.h>
 
-static task_pid_t current_task = 0; ///< the currently running task pid
-static uint32_t ticks_per_time_slice = 1; ///< 1 tick = frequency of the PIT
+/// how often all tasks are reset to their base priority (1 tick = frequency of the PIT)
+#define BOOST_INTERVAL 50
+/// how often the run queues are balanced
+#define BALANCE_INTERVAL 20
+/// how much of the CPU (in per mille) real-time tasks may reserve, the rest is
+/// left for best-effort tasks
+#define REALTIME_MAX_UTILIZATION 900
+
+/// a CPU's run queue, a circular list of the tasks assigned to that CPU
+typedef struct {
+    task_pid_t first; ///< the first task in the queue or 0 if it is empty
+    uint32_t length;  ///< number of tasks in the queue, runnable or not
+} schedule_queue_t;
+
+static schedule_queue_t queues[SMP_MAX_CPUS] = {{0}}; ///< one run queue per CPU
+static timer_t boost_timer, balance_timer; ///< fire every BOOST_INTERVAL / BALANCE_INTERVAL
+static schedstats_t stats = {0}; ///< context switch and latency histograms
+static task_pid_t zombies = 0, last_zombie = 0; ///< exited tasks to be released
+static wait_queue_t reaper_queue = {0}; ///< the reaper waits here for zombies
+static wait_queue_t exit_queue = {0}; ///< tasks waiting for a child to exit
+static uint32_t realtime_tasks = 0; ///< number of tasks in the real-time class
+static uint32_t realtime_utilization = 0; ///< CPU reserved for them (per mille)
+static spinlock_t lock = SPINLOCK_INIT("Scheduler"); ///< protects the state above
+
+/**
+ * Returns this CPU's idle task which runs when it has nothing to do.
+ * @return the idle task's PID
+ */
+static inline task_pid_t schedule_get_idle_task() {
+    return smp_get_cpu()->idle_task;
+}
+
+/// The idle task. Halts the CPU until the next interrupt, forever.
+static void schedule_idle() {
+    while (1)
+        asm volatile("sti; hlt");
+}
+
+/**
+ * The reaper thread. Releases the resources of exited tasks as soon as
+ * possible. We can't do that when a task exits because we are operating on
+ * its kernel stack which we cannot free while it is still in use.
+ * Tasks nobody waits for are destroyed right away, the others are kept as
+ * zombies until their parent collected the exit code.
+ */
+static void schedule_reaper() {
+    while (1) {
+        isr_enable_interrupts(0); // the parent might collect the task meanwhile
+        while (!zombies)
+            wait_block(&reaper_queue);
+        uint8_t interrupts = spinlock_lock_irqsave(&lock);
+        task_pid_t pid = zombies;
+        if (!(zombies = task_get_wait_next(pid)))
+            last_zombie = 0;
+        spinlock_unlock_irqrestore(&lock, interrupts);
+        task_get_elf(pid) ? elf_release_task(pid) : task_release(pid);
+        if (!task_get_parent(pid))
+            task_destroy(pid);
+        isr_enable_interrupts(1);
+    }
+}
+
+/**
+ * Returns the time slice for a given level. Each level's time slice is twice
+ * as long as the one above, so CPU hogs are switched less often.
+ * @param priority the priority level
+ * @return the number of ticks a task on this level may run
+ */
+static uint32_t schedule_get_time_slice(uint8_t priority) {
+    return 1 << priority; // 1 tick = frequency of the PIT
+}
+
+/**
+ * Moves a task one level down because it used up its whole time slice.
+ * @param pid the task's PID
+ */
+static void schedule_demote(task_pid_t pid) {
+    uint8_t priority = task_get_priority(pid);
+    if (priority < SCHEDULE_PRIORITIES - 1)
+        task_set_priority(pid, priority + 1);
+}
+
+/**
+ * Moves a task one level up because it gave up the CPU early.
+ * @param pid the task's PID
+ */
+static void schedule_promote(task_pid_t pid) {
+    uint8_t priority = task_get_priority(pid);
+    if (priority > task_get_base_priority(pid))
+        task_set_priority(pid, priority - 1);
+}
+
+/**
+ * Counts a duration in a histogram with logarithmic buckets.
+ * @param histogram the histogram
+ * @param cycles    the duration in TSC cycles
+ */
+static void schedule_count(uint32_t* histogram, uint64_t cycles) {
+    uint32_t high = cycles >> 32, low = cycles;
+    // the last bucket also takes everything longer than 2^32 cycles
+    histogram[high ? TASKSTATS_BUCKETS - 1 : (low ? 31 - __builtin_clz(low) : 0)]++;
+}
+
+/// Resets all tasks to their base priority so that no task starves.
+static void schedule_boost() {
+    task_pid_t initial_pid = task_get_next_task(0), pid = initial_pid;
+    if (!initial_pid)
+        return;
+    do
+        task_set_priority(pid, task_get_base_priority(pid));
+    while ((pid = task_get_next_task(pid)) != initial_pid);
+}
+
+/**
+ * Returns whether a task may run on a given CPU.
+ * @param pid the task's PID
+ * @param cpu the CPU's ID
+ * @return whether the task's affinity includes the CPU
+ */
+static uint8_t schedule_is_allowed(task_pid_t pid, uint32_t cpu) {
+    return (task_get_affinity(pid) >> cpu) & 1;
+}
+
+/**
+ * Appends a task to a CPU's run queue.
+ * @param pid the task's PID
+ * @param cpu the CPU's ID
+ */
+static void schedule_link(task_pid_t pid, uint32_t cpu) {
+    schedule_queue_t* queue = queues + cpu;
+    if (queue->first) {
+        task_pid_t last = task_get_run_prev(queue->first);
+        task_set_run_next(last, pid);
+        task_set_run_prev(pid, last);
+        task_set_run_next(pid, queue->first);
+        task_set_run_prev(queue->first, pid);
+    } else {
+        queue->first = pid;
+        task_set_run_next(pid, pid);
+        task_set_run_prev(pid, pid);
+    }
+    queue->length++;
+    task_set_queue(pid, cpu);
+}
+
+/**
+ * Removes a task from its run queue, if it is in one.
+ * @param pid the task's PID
+ */
+static void schedule_unlink(task_pid_t pid) {
+    uint32_t cpu = task_get_queue(pid);
+    if (cpu == SCHEDULE_NO_QUEUE)
+        return;
+    schedule_queue_t* queue = queues + cpu;
+    task_pid_t next = task_get_run_next(pid), prev = task_get_run_prev(pid);
+    if (next == pid)
+        queue->first = 0;
+    else {
+        task_set_run_next(prev, next);
+        task_set_run_prev(next, prev);
+        if (queue->first == pid)
+            queue->first = next;
+    }
+    queue->length--;
+    task_set_queue(pid, SCHEDULE_NO_QUEUE);
+}
+
+/**
+ * Moves a task to another CPU's run queue.
+ * @param pid the task's PID
+ * @param cpu the new CPU's ID
+ */
+static void schedule_migrate(task_pid_t pid, uint32_t cpu) {
+    uint32_t old_cpu = task_get_queue(pid);
+    if (old_cpu == cpu)
+        return;
+    schedule_unlink(pid);
+    schedule_link(pid, cpu);
+    if (old_cpu != SCHEDULE_NO_QUEUE) {
+        logln("SCHEDULE", "Migrating task %d from CPU %d to CPU %d", pid, old_cpu, cpu);
+        stats.cpu_migrations[cpu]++;
+    }
+}
+
+/**
+ * Returns a CPU's load, that is, the number of runnable tasks in its run queue.
+ * @param cpu the CPU's ID
+ * @return the CPU's load
+ */
+static uint32_t schedule_get_load(uint32_t cpu) {
+    task_pid_t first = queues[cpu].first, pid = first;
+    uint32_t load = 0;
+    if (first)
+        do
+            load += task_get_state(pid) == TASK_RUNNING;
+        while ((pid = task_get_run_next(pid)) != first);
+    return load;
+}
 
 /**
- * Returns the next task to run.
+ * Wakes up a CPU whose tick is stopped when a task became runnable, so the
+ * task does not have to wait for that CPU's next tick. This is the CPU whose
+ * run queue holds the task or else any idle CPU that may steal it.
+ * @param pid the task's PID
+ */
+void schedule_kick(task_pid_t pid) {
+    __sync_synchronize(); // pairs with the one in schedule_stop_tick()
+    uint32_t cpu = task_get_queue(pid), cpus = smp_get_cpu_number();
+    if (cpu == SCHEDULE_NO_QUEUE || !smp_get_cpu_by_id(cpu)->tickless)
+        for (cpu = 0; cpu < cpus; cpu++)
+            if (smp_get_cpu_by_id(cpu)->tickless && schedule_is_allowed(pid, cpu))
+                break;
+    if (cpu < cpus)
+        lapic_timer_kick(cpu);
+}
+
+/**
+ * Puts a new task into the least loaded run queue it may run on.
+ * @param pid the task's PID
+ */
+void schedule_enqueue(task_pid_t pid) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    uint32_t cpu = 0, load = -1;
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++) {
+        uint32_t cpu_load = schedule_get_load(i);
+        if (schedule_is_allowed(pid, i) && cpu_load < load) {
+            cpu = i;
+            load = cpu_load;
+        }
+    }
+    schedule_link(pid, cpu);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    schedule_kick(pid);
+}
+
+/**
+ * Moves waiting tasks from the busiest to the idlest run queue until their
+ * loads differ by at most one. The task that waited the longest is moved
+ * first because its data is least likely to be in the old CPU's cache.
+ */
+static void schedule_balance() {
+    uint32_t loads[SMP_MAX_CPUS], busiest = 0, idlest = 0;
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++) {
+        loads[i] = schedule_get_load(i);
+        if (loads[i] > loads[busiest])
+            busiest = i;
+        if (loads[i] < loads[idlest])
+            idlest = i;
+    }
+    while (loads[busiest] >= loads[idlest] + 2) {
+        task_pid_t first = queues[busiest].first, pid = first, coldest = 0;
+        do
+            if (task_get_state(pid) == TASK_RUNNING && !task_get_on_cpu(pid) &&
+                    schedule_is_allowed(pid, idlest) && (!coldest ||
+                    task_get_switch_tsc(pid) < task_get_switch_tsc(coldest)))
+                coldest = pid;
+        while ((pid = task_get_run_next(pid)) != first);
+        if (!coldest)
+            return; // all waiting tasks are pinned
+        schedule_migrate(coldest, idlest);
+        schedule_kick(coldest);
+        loads[busiest]--;
+        loads[idlest]++;
+    }
+}
+
+/**
+ * Returns whether a task is in the real-time class.
+ * @param pid the task's PID
+ * @return whether the task is a real-time task
+ */
+static uint8_t schedule_is_realtime(task_pid_t pid) {
+    return task_get_realtime(pid)->period != 0;
+}
+
+/**
+ * Starts a new period for every real-time task whose deadline has come and
+ * refills its budget. If the task was still waiting for the CPU with budget
+ * left, it missed its deadline.
+ */
+static void schedule_release() {
+    if (!realtime_tasks)
+        return;
+    uint32_t now = pit_get_ticks();
+    task_pid_t initial_pid = task_get_next_task(0), pid = initial_pid;
+    do {
+        task_realtime_t* realtime = task_get_realtime(pid);
+        if (!realtime->period || (int32_t) (now - realtime->deadline) < 0)
+            continue;
+        if (realtime->left && task_get_state(pid) == TASK_RUNNING)
+            task_get_stats(pid)->deadline_misses++;
+        realtime->deadline += realtime->period;
+        if ((int32_t) (now - realtime->deadline) >= 0) // we are behind by more
+            realtime->deadline = now + realtime->period; // than one period
+        realtime->left = realtime->budget;
+    } while ((pid = task_get_next_task(pid)) != initial_pid);
+}
+
+/**
+ * Ends the current period's job of a real-time task, it waits for the next
+ * release. Called when a real-time task gives up the CPU.
+ * @param pid the task's PID
+ */
+static void schedule_complete(task_pid_t pid) {
+    task_get_realtime(pid)->left = 0;
+}
+
+/**
+ * Wakes up a sleeping task. Called by the timer queue.
+ * @param data the task's PID
+ */
+static void schedule_wake(void* data) {
+    task_wake((task_pid_t) data);
+}
+
+/**
+ * Boosts all tasks and restarts the boost timer. Called by the timer wheel.
+ * @param data unused
+ */
+static void schedule_handle_boost(void* data) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    schedule_boost();
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    timer_add(&boost_timer, BOOST_INTERVAL, schedule_handle_boost, 0);
+}
+
+/**
+ * Balances the run queues and restarts the balance timer. Called by the timer
+ * wheel.
+ * @param data unused
+ */
+static void schedule_handle_balance(void* data) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    schedule_balance();
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    timer_add(&balance_timer, BALANCE_INTERVAL, schedule_handle_balance, 0);
+}
+
+/**
+ * Accounts for a tick and returns the next task to run. The caller needs to
+ * hold the scheduler lock.
  * @param cpu the current task's CPU state
  * @return the next task's CPU state
  */
-cpu_state_t* schedule(cpu_state_t* cpu) {
-    task_pid_t next_task = schedule_get_next_task();
-    if (!next_task)
-        return cpu; /// Does nothing if there are no tasks yet.
-    if (current_task) {
-        /// Does not switch tasks if the current task's time slice is not over yet.
-        if (task_set_ticks(current_task, task_get_ticks(current_task) - 1) > 1)
+static cpu_state_t* schedule_tick(cpu_state_t* cpu) {
+    task_pid_t current_task = schedule_get_current_task();
+    uint32_t cpu_id = smp_get_cpu()->id;
+    stats.cpu_ticks[cpu_id]++;
+    /// Charges the last tick to the current real-time task's budget before
+    /// releasing the next period.
+    if (current_task && task_exists(current_task) &&
+            schedule_is_realtime(current_task) && task_get_realtime(current_task)->left)
+        task_get_realtime(current_task)->left--;
+    if (cpu_id == 0)
+        schedule_release();
+    if (current_task && current_task == schedule_get_idle_task()) {
+        /// The idle task has no time slice, it is left as soon as possible.
+        stats.cpu_idle_ticks[cpu_id]++;
+        task_set_cpu(current_task, cpu);
+        task_pid_t next_task = schedule_get_next_task();
+        return next_task == schedule_get_idle_task() ? cpu : schedule_switch_task(next_task);
+    }
+    if (current_task && schedule_is_realtime(current_task)) {
+        /// A real-time task runs until its budget is used up or a task with
+        /// an earlier deadline is released.
+        task_set_cpu(current_task, cpu);
+        task_pid_t next_task = schedule_get_next_task();
+        if (next_task == current_task)
             return cpu;
+        task_get_stats(current_task)->involuntary_switches++;
+        return schedule_switch_task(next_task);
+    }
+    if (current_task) {
         task_set_cpu(current_task, cpu); // save the current ESP / CPU state
+        uint32_t ticks = task_get_ticks(current_task);
+        if (ticks > 1) {
+            task_set_ticks(current_task, ticks - 1);
+            /// Does not switch tasks if the current task's time slice is not
+            /// over yet, unless a task on a higher level or a real-time task
+            /// is waiting.
+            task_pid_t next_task = schedule_get_next_task();
+            if (!next_task || (!schedule_is_realtime(next_task) &&
+                    task_get_priority(next_task) >= task_get_priority(current_task)))
+                return cpu;
+            task_get_stats(current_task)->involuntary_switches++;
+            return schedule_switch_task(next_task);
+        }
+        /// A task that used up its time slice is demoted.
+        task_set_ticks(current_task, 0);
+        schedule_demote(current_task);
     }
-    if (current_task == next_task) // no switch is needed
+    task_pid_t next_task = schedule_get_next_task();
+    if (!next_task)
+        return cpu; /// Does nothing if there are no tasks yet.
+    if (current_task == next_task) { // no switch is needed
+        task_set_ticks(current_task,
+                schedule_get_time_slice(task_get_priority(current_task)));
         return cpu;
+    }
     /// Otherwise switches to the next task.
+    if (current_task)
+        task_get_stats(current_task)->involuntary_switches++;
     return schedule_switch_task(next_task);
 }
 
 /**
- * Switches to a given task.
+ * Stops this CPU's tick if it is going to idle. The boot CPU wakes up again
+ * for the next timer (which includes boosting and balancing). The caller
+ * needs to hold the scheduler lock.
+ */
+static void schedule_stop_tick() {
+    if (schedule_get_current_task() != schedule_get_idle_task() || realtime_tasks)
+        return;
+    uint32_t ticks = 0; // the other CPUs wait for schedule_kick()
+    if (smp_get_cpu()->id == 0 && !(ticks = timer_get_ticks_left(pit_get_ticks())))
+        return; // a timer is due right now
+    if (!lapic_timer_stop(ticks))
+        return; // the PIT drives the tick, it cannot be stopped
+    __sync_synchronize(); // either we see a new task or schedule_kick() sees us
+    if (schedule_get_next_task() != schedule_get_idle_task())
+        lapic_timer_resume(); // it is picked up on the next tick
+}
+
+/**
+ * Returns the next task to run. Called on every tick.
+ * @param cpu the current task's CPU state
+ * @return the next task's CPU state
+ */
+cpu_state_t* schedule(cpu_state_t* cpu) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    cpu = schedule_tick(cpu);
+    schedule_stop_tick();
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return cpu;
+}
+
+/**
+ * Accounts for ticks this CPU slept through while its tick was stopped. The
+ * CPU was idle all the time. The boot CPU's timers are not skipped, see
+ * timer_handle_tick().
+ * @param ticks the number of ticks
+ */
+void schedule_skip_ticks(uint32_t ticks) {
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    uint32_t cpu_id = smp_get_cpu()->id;
+    stats.cpu_ticks[cpu_id] += ticks;
+    stats.cpu_idle_ticks[cpu_id] += ticks;
+    spinlock_unlock_irqrestore(&lock, interrupts);
+}
+
+/**
+ * Gives up the CPU voluntarily, because the current task either blocked or
+ * yielded. Such a task is boosted one level up. A real-time task has finished
+ * its job for the current period instead.
+ * @param cpu the current task's CPU state
+ * @return the next task's CPU state
+ */
+cpu_state_t* schedule_yield(cpu_state_t* cpu) {
+    task_pid_t current_task = schedule_get_current_task();
+    if (!current_task)
+        return cpu;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    task_set_cpu(current_task, cpu);
+    task_set_ticks(current_task, 0);
+    schedule_is_realtime(current_task) ?
+        schedule_complete(current_task) : schedule_promote(current_task);
+    task_pid_t next_task = schedule_get_next_task();
+    if (!next_task || next_task == current_task)
+        task_set_ticks(current_task,
+                schedule_get_time_slice(task_get_priority(current_task)));
+    else {
+        task_get_stats(current_task)->voluntary_switches++;
+        cpu = schedule_switch_task(next_task);
+    }
+    schedule_stop_tick();
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return cpu;
+}
+
+/**
+ * Switches to a given task. The caller needs to hold the scheduler lock.
  * @param next_task the new task's PID
  * @return the new task's CPU state
  */
 cpu_state_t* schedule_switch_task(task_pid_t next_task) {
+    task_pid_t current_task = schedule_get_current_task();
     if (current_task)
         logln("SCHEDULE", "Task switch from task %d to task %d",
             current_task, next_task);
@@ -57,13 +563,47 @@ cpu_state_t* schedule_switch_task(task_pid_t next_task) {
     // or next_task->cpu + 1. We will use that as ESP when we are interrupted
     // the next time. Note that this has no effect when we stay in the kernel.
     tss_set_stack((uint32_t) (task_get_cpu(next_task) + 1));
-    /// Refills the new task's time slice.
-    task_set_ticks(next_task, ticks_per_time_slice);
-    /// Switches to the new virtual address space.
-    io_set_logging(0);
-    vmm_load_page_directory(task_get_page_directory(next_task));
-    io_set_logging(1);
-    current_task = next_task;
+    /// Accounts the time the old task ran and the new task waited.
+    uint64_t now = tsc_read(), cycles;
+    if (current_task && task_exists(current_task)) {
+        cycles = now - task_get_switch_tsc(current_task);
+        task_get_stats(current_task)->run_cycles += cycles;
+        schedule_count(stats.run_histogram, cycles);
+        task_set_switch_tsc(current_task, now);
+    }
+    cycles = now - task_get_switch_tsc(next_task);
+    task_get_stats(next_task)->wait_cycles += cycles;
+    schedule_count(stats.latency_histogram, cycles);
+    task_set_switch_tsc(next_task, now);
+    stats.switches++;
+    /// Refills the new task's time slice according to its level.
+    task_set_ticks(next_task, schedule_get_time_slice(task_get_priority(next_task)));
+    /// Switches to the new virtual address space, unless both tasks share it
+    /// (then we don't need to reload CR3 and flush the TLB).
+    if (!current_task || !task_exists(current_task) ||
+            task_get_page_directory(current_task) != task_get_page_directory(next_task)) {
+        io_set_logging(0);
+        vmm_load_page_directory(task_get_page_directory(next_task));
+        io_set_logging(1);
+    }
+    fpu_switch_task(current_task, next_task); /// Lets the FPU state follow lazily.
+    /// Hands over this CPU's kernel lock depth to the new task and marks which
+    /// tasks are running so that other CPUs don't pick them.
+    smp_cpu_t* this_cpu = smp_get_cpu();
+    if (current_task && task_exists(current_task)) {
+        task_set_lock_depth(current_task, this_cpu->lock_depth);
+        task_set_on_cpu(current_task, 0);
+    }
+    this_cpu->lock_depth = task_get_lock_depth(next_task);
+    task_set_on_cpu(next_task, 1);
+    /// A task taken from another CPU (stolen or real-time) now belongs to this
+    /// CPU's run queue.
+    if (task_get_queue(next_task) != SCHEDULE_NO_QUEUE)
+        schedule_migrate(next_task, this_cpu->id);
+    /// Points the TLS segment to the new task's thread-local storage. GS is
+    /// reloaded from the GDT when the CPU state is popped in isr_asm.S.
+    gdt_set_tls(task_get_tls(next_task));
+    this_cpu->current_task = next_task;
     return task_get_cpu(next_task); // restore the CPU state / ESP saved earlier
 }
 
@@ -72,22 +612,394 @@ cpu_state_t* schedule_switch_task(task_pid_t next_task) {
  * @return the current task's PID
  */
 task_pid_t schedule_get_current_task() {
-    return current_task;
+    return smp_get_cpu()->current_task;
+}
+
+/**
+ * Returns whether a task may run on this CPU, that is, it is runnable, not
+ * running on another CPU and its affinity allows this CPU.
+ * @param pid the task's PID
+ * @return whether the task may be switched to
+ */
+static uint8_t schedule_is_runnable(task_pid_t pid) {
+    return task_get_state(pid) == TASK_RUNNING &&
+            (!task_get_on_cpu(pid) || pid == schedule_get_current_task()) &&
+            schedule_is_allowed(pid, smp_get_cpu()->id);
+}
+
+/**
+ * Returns the released real-time task with the earliest deadline.
+ * @return the real-time task's PID or 0 if no real-time task may run
+ */
+static task_pid_t schedule_get_next_realtime_task() {
+    task_pid_t initial_pid = task_get_next_task(0), pid = initial_pid,
+            next_task = 0;
+    uint32_t next_deadline = 0;
+    if (!realtime_tasks)
+        return 0;
+    do {
+        task_realtime_t* realtime = task_get_realtime(pid);
+        if (realtime->period && realtime->left && schedule_is_runnable(pid) &&
+                (!next_task || (int32_t) (realtime->deadline - next_deadline) < 0)) {
+            next_task = pid;
+            next_deadline = realtime->deadline;
+        }
+    } while ((pid = task_get_next_task(pid)) != initial_pid);
+    return next_task;
+}
+
+/**
+ * Returns the first runnable best-effort task on the highest non-empty level
+ * of a run queue.
+ * @param initial_pid where to start in the run queue, so that tasks on the
+ *                    same level take turns
+ * @return the task's PID or 0 if no task in the run queue is runnable
+ */
+static task_pid_t schedule_scan_queue(task_pid_t initial_pid) {
+    task_pid_t pid = initial_pid, next_task = 0;
+    uint8_t next_priority = SCHEDULE_PRIORITIES;
+    if (!initial_pid)
+        return 0;
+    do
+        if (schedule_is_runnable(pid) && !schedule_is_realtime(pid) &&
+                task_get_priority(pid) < next_priority) {
+            next_task = pid;
+            next_priority = task_get_priority(pid);
+        }
+    while ((pid = task_get_run_next(pid)) != initial_pid);
+    return next_task;
 }
 
 /**
- * Returns the next running task's PID.
+ * Steals a runnable task from the busiest run queue. Called when this CPU
+ * would be idle otherwise.
+ * @return the task's PID or 0 if there is nothing to steal
+ */
+static task_pid_t schedule_steal() {
+    uint32_t cpu = smp_get_cpu()->id, busiest = cpu, busiest_load = 0;
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++) {
+        uint32_t load = schedule_get_load(i);
+        if (i != cpu && load > busiest_load) {
+            busiest = i;
+            busiest_load = load;
+        }
+    }
+    return busiest == cpu ? 0 : schedule_scan_queue(queues[busiest].first);
+}
+
+/**
+ * Returns the next running task's PID. Released real-time tasks come first,
+ * see schedule_get_next_realtime_task(). Otherwise, this is the first running
+ * best-effort task on the highest non-empty level of this CPU's run queue,
+ * starting after the current task so that tasks on the same level take turns.
+ * If this CPU's run queue has no runnable task, a task is stolen from another
+ * CPU. If there is none, this is the idle task. The caller needs to hold the
+ * scheduler lock.
  * @return the next running task's PID
  */
 task_pid_t schedule_get_next_task() {
-    return task_get_next_task_with_state(current_task, TASK_RUNNING);
+    task_pid_t current_task = schedule_get_current_task();
+    uint32_t cpu = smp_get_cpu()->id;
+    task_pid_t next_task;
+    if (!task_get_next_task(0))
+        return 0;
+    if ((next_task = schedule_get_next_realtime_task()))
+        return next_task;
+    if (current_task && task_exists(current_task) && task_get_queue(current_task) == cpu)
+        next_task = schedule_scan_queue(task_get_run_next(current_task));
+    else
+        next_task = schedule_scan_queue(queues[cpu].first);
+    if (!next_task)
+        next_task = schedule_steal();
+    return next_task ? next_task : schedule_get_idle_task();
+}
+
+/**
+ * Gives up the CPU in favor of a given task, e.g. a consumer the current task
+ * just produced something for. The given task runs immediately, regardless of
+ * its level. Like schedule_yield(), the current task is boosted.
+ * @param cpu the current task's CPU state
+ * @param pid the task to switch to
+ * @return the next task's CPU state or 0 if the given task is not runnable
+ */
+cpu_state_t* schedule_yield_to(cpu_state_t* cpu, task_pid_t pid) {
+    task_pid_t current_task = schedule_get_current_task();
+    if (!current_task || !task_exists(pid) || pid == schedule_get_idle_task())
+        return 0;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    if (!schedule_is_runnable(pid))
+        cpu = 0;
+    else if (pid != current_task) {
+        task_set_cpu(current_task, cpu);
+        task_set_ticks(current_task, 0);
+        schedule_is_realtime(current_task) ?
+            schedule_complete(current_task) : schedule_promote(current_task);
+        task_get_stats(current_task)->voluntary_switches++;
+        cpu = schedule_switch_task(pid);
+    }
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return cpu;
+}
+
+/**
+ * Blocks the current task for a given time and switches to another task.
+ * @param cpu the current task's CPU state
+ * @param ms  how many milliseconds to sleep, if 0 the task just gives up the CPU
+ * @return the next task's CPU state
+ */
+cpu_state_t* schedule_sleep(cpu_state_t* cpu, uint32_t ms) {
+    task_pid_t current_task = schedule_get_current_task();
+    uint32_t ticks = pit_ms_to_ticks(ms);
+    if (current_task && current_task != schedule_get_idle_task() && ticks) {
+        /// Block before the timer is armed, otherwise a short timer could fire
+        /// on the boot CPU in between and the task would miss its wakeup.
+        task_block(current_task);
+        timer_add(task_get_timer(current_task), ticks, schedule_wake,
+                (void*) current_task);
+    }
+    return schedule_yield(cpu);
+}
+
+/**
+ * Sets a task's base priority. The task is moved to that level immediately.
+ * @param pid      the task's PID, 0 for the current task
+ * @param priority the new base priority (0 is the highest)
+ * @return the old base priority or -1 if the task or priority is invalid
+ */
+uint32_t schedule_set_priority(task_pid_t pid, uint8_t priority) {
+    if (!pid)
+        pid = schedule_get_current_task();
+    if (!task_exists(pid) || pid == schedule_get_idle_task() ||
+            priority >= SCHEDULE_PRIORITIES)
+        return -1;
+    /// Demoting, promoting and boosting change the level under the scheduler
+    /// lock, so we hold it too.
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    uint8_t old_priority = task_get_base_priority(pid);
+    task_set_base_priority(pid, priority);
+    task_set_priority(pid, priority);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return old_priority;
+}
+
+/**
+ * Moves a task into or out of the real-time class if the utilization allows.
+ * The caller needs to hold the scheduler lock.
+ * @param pid    the task's PID
+ * @param period the task's period in ticks, 0 to make it a best-effort task
+ * @param budget how many ticks the task may run per period
+ * @return 0 or -1 if the parameters are invalid or the task would exceed the
+ *         available utilization
+ */
+static uint32_t schedule_admit(task_pid_t pid, uint32_t period, uint32_t budget) {
+    task_realtime_t* realtime = task_get_realtime(pid);
+    // round up so that rounding errors cannot sum up to more than the maximum
+    uint32_t utilization = period ? (budget * 1000 + period - 1) / period : 0,
+            old_utilization = realtime->period ?
+            (realtime->budget * 1000 + realtime->period - 1) / realtime->period : 0;
+    if ((period && (!budget || budget > period)) || realtime_utilization -
+            old_utilization + utilization > REALTIME_MAX_UTILIZATION)
+        return -1;
+    realtime_utilization = realtime_utilization - old_utilization + utilization;
+    realtime_tasks += (period != 0) - (realtime->period != 0);
+    realtime->period = period;
+    realtime->budget = realtime->left = budget;
+    realtime->deadline = pit_get_current_ticks() + period;
+    return 0;
+}
+
+/**
+ * Moves a task into or out of the real-time class. A task is only admitted if
+ * the total utilization of all real-time tasks stays below
+ * REALTIME_MAX_UTILIZATION. Its first period starts immediately.
+ * @param pid    the task's PID, 0 for the current task
+ * @param period the task's period in milliseconds, 0 to make it a best-effort
+ *               task again
+ * @param budget how many milliseconds the task may run per period
+ * @return 0 or -1 if the task or parameters are invalid or the task would
+ *         exceed the available utilization
+ */
+uint32_t schedule_set_realtime(task_pid_t pid, uint32_t period, uint32_t budget) {
+    if (!pid)
+        pid = schedule_get_current_task();
+    if (!task_exists(pid) || pid == schedule_get_idle_task())
+        return -1;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    uint32_t result = schedule_admit(pid, pit_ms_to_ticks(period),
+            pit_ms_to_ticks(budget));
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return result;
+}
+
+/**
+ * Pins a task to some CPUs. If the task's run queue is not among them, the
+ * task is moved to the first allowed CPU. If it is running on a CPU it may
+ * not use anymore, it leaves that CPU at the end of its time slice.
+ * @param pid      the task's PID, 0 for the current task
+ * @param affinity a bit mask with bit i set if the task may run on CPU i
+ * @return 0 or -1 if the task does not exist or no running CPU is allowed
+ */
+uint32_t schedule_set_affinity(task_pid_t pid, uint32_t affinity) {
+    if (!pid)
+        pid = schedule_get_current_task();
+    affinity &= SCHEDULE_ALL_CPUS;
+    if (!task_exists(pid) || pid == schedule_get_idle_task() ||
+            !(affinity & ((1 << smp_get_cpu_number()) - 1)))
+        return -1;
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    task_set_affinity(pid, affinity);
+    uint32_t cpu = task_get_queue(pid);
+    if (cpu != SCHEDULE_NO_QUEUE && !schedule_is_allowed(pid, cpu))
+        schedule_migrate(pid, __builtin_ctz(affinity));
+    schedule_kick(pid);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return 0;
+}
+
+/**
+ * Exits the current task and switches to the next task. The task is handed
+ * over to the reaper thread which releases it.
+ * @param cpu       the current task's CPU state
+ * @param exit_code passed on to the parent
+ * @return the next task's CPU state
+ */
+cpu_state_t* schedule_exit(cpu_state_t* cpu, uint32_t exit_code) {
+    task_pid_t current_task = schedule_get_current_task();
+    /// We tell the scheduler to not switch to this task again.
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    task_stop(current_task);
+    schedule_unlink(current_task);
+    schedule_admit(current_task, 0, 0); // frees its utilization
+    task_set_exit_code(current_task, exit_code);
+    task_orphan_children(current_task);
+    task_set_wait_next(current_task, 0);
+    if (last_zombie)
+        task_set_wait_next(last_zombie, current_task);
+    else
+        zombies = current_task;
+    last_zombie = current_task;
+    wait_wake_one(&reaper_queue);
+    wait_wake_all(&exit_queue); // the parent might be waiting
+    cpu = schedule_switch_task(schedule_get_next_task());
+    schedule_stop_tick();
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    return cpu;
+}
+
+/**
+ * Collects the exit code of a child task that has exited.
+ * @param pid       the child's PID
+ * @param exit_code where to store the exit code, may be 0
+ * @return the child's PID, 0 if it has not exited yet or -1 if the given task
+ *         is not a child of the current task
+ */
+uint32_t schedule_collect(task_pid_t pid, uint32_t* exit_code) {
+    task_pid_t current_task = schedule_get_current_task();
+    if (!task_exists(pid) || !current_task || task_get_parent(pid) != current_task)
+        return -1;
+    task_state_t state = task_get_state(pid);
+    if (state != TASK_STOPPED && state != TASK_ZOMBIE)
+        return 0;
+    if (exit_code)
+        *exit_code = task_get_exit_code(pid);
+    task_set_parent(pid, 0); /// Nobody needs the task anymore, so if it is
+    if (state == TASK_ZOMBIE) /// not released yet, the reaper destroys it.
+        task_destroy(pid);
+    return pid;
+}
+
+/**
+ * Blocks the current task until any task exits.
+ * @param cpu the current task's CPU state
+ * @return the next task's CPU state
+ */
+cpu_state_t* schedule_wait_exit(cpu_state_t* cpu) {
+    return wait_sleep(&exit_queue, cpu);
+}
+
+/**
+ * Returns a task's CPU accounting. For the current task, this includes the
+ * time it is running right now.
+ * @param pid   the task's PID, 0 for the current task
+ * @param stats where to store the statistics
+ * @return 0 or -1 if the task does not exist
+ */
+uint32_t schedule_get_taskstats(task_pid_t pid, taskstats_t* stats) {
+    task_pid_t current_task = schedule_get_current_task();
+    if (!pid)
+        pid = current_task;
+    if (!task_exists(pid))
+        return -1;
+    *stats = *task_get_stats(pid);
+    stats->pid = pid;
+    stats->state = task_get_state(pid);
+    stats->priority = task_get_priority(pid);
+    if (pid == current_task)
+        stats->run_cycles += tsc_read() - task_get_switch_tsc(pid);
+    return 0;
+}
+
+/**
+ * Returns the global scheduler statistics.
+ * @return the context switch and latency histograms
+ */
+schedstats_t* schedule_get_schedstats() {
+    stats.cpus = smp_get_cpu_number();
+    return &stats;
+}
+
+/**
+ * Dumps a histogram's non-empty buckets. The dump is logged.
+ * @param name      the histogram's name
+ * @param histogram the histogram
+ */
+static void schedule_dump_histogram(char* name, uint32_t* histogram) {
+    logln("SCHEDULE", "%s (log2 cycles: count):", name);
+    for (int i = 0; i < TASKSTATS_BUCKETS; i++)
+        if (histogram[i])
+            logln("SCHEDULE", "  %2d: %u", i, histogram[i]);
+}
+
+/// Dumps the scheduler's idle time per CPU and histograms. The dump is logged.
+void schedule_dump() {
+    for (uint32_t i = 0; i < smp_get_cpu_number(); i++) {
+        uint32_t ticks = stats.cpu_ticks[i], idle_ticks = stats.cpu_idle_ticks[i];
+        // divide ticks first so that idle_ticks * 100 cannot overflow
+        logln("SCHEDULE", "CPU %u: idle for %u of %u ticks (%u%%), %u tasks queued, "
+                "%u migrated here", i, idle_ticks, ticks,
+                ticks >= 100 ? idle_ticks / (ticks / 100) : 0, queues[i].length,
+                stats.cpu_migrations[i]);
+    }
+    logln("SCHEDULE", "%u task switches", stats.switches);
+    logln("SCHEDULE", "%u real-time tasks reserve %u/1000 of the CPU",
+            realtime_tasks, realtime_utilization);
+    schedule_dump_histogram("Run time before switching", stats.run_histogram);
+    schedule_dump_histogram("Latency until running", stats.latency_histogram);
+    spinlock_dump(&lock);
+}
+
+/**
+ * Creates this CPU's idle task. It is blocked so that no other CPU picks it,
+ * this CPU only switches to it explicitly when nothing else is runnable.
+ */
+void schedule_init_cpu() {
+    task_pid_t idle_task = task_create_kernel_thread(schedule_idle, _4KB);
+    smp_get_cpu()->idle_task = idle_task;
+    task_block(idle_task);
+    uint8_t interrupts = spinlock_lock_irqsave(&lock);
+    schedule_unlink(idle_task);
+    spinlock_unlock_irqrestore(&lock, interrupts);
+    task_set_base_priority(idle_task, SCHEDULE_PRIORITIES - 1);
+    task_set_priority(idle_task, SCHEDULE_PRIORITIES - 1);
 }
 
-/// Destroys tasks marked for removal.
-void schedule_finalize_tasks() {
-    task_pid_t pid = 0;
-    while ((pid = task_get_next_task_with_state(pid, TASK_STOPPED)))
-        task_get_elf(pid) ? elf_destroy_task(pid) : task_destroy(pid);
+/// Creates the boot CPU's idle task and the reaper thread and starts the
+/// bookkeeping timers. Should be called before any other task is created.
+void schedule_init() {
+    schedule_init_cpu();
+    task_create_kernel_thread(schedule_reaper, _4KB);
+    timer_add(&boost_timer, BOOST_INTERVAL, schedule_handle_boost, 0);
+    timer_add(&balance_timer, BALANCE_INTERVAL, schedule_handle_balance, 0);
 }
 
 /// @}
@@ -10,12 +10,34 @@
 #include <stdint.h>
 #include <interrupts/isr.h>
 #include <tasks/task.h>
+#include <hardware/cpu/smp.h>
+#include <taskstats.h>
+
+#define SCHEDULE_PRIORITIES 4 ///< number of levels in the feedback queue
+#define SCHEDULE_ALL_CPUS ((1 << SMP_MAX_CPUS) - 1) ///< affinity of tasks that may run anywhere
+#define SCHEDULE_NO_QUEUE ((uint32_t) -1) ///< queue of tasks that are in no run queue
 
 cpu_state_t* schedule(cpu_state_t* cpu);
+cpu_state_t* schedule_yield(cpu_state_t* cpu);
+cpu_state_t* schedule_yield_to(cpu_state_t* cpu, task_pid_t pid);
+cpu_state_t* schedule_sleep(cpu_state_t* cpu, uint32_t ms);
 cpu_state_t* schedule_switch_task(task_pid_t next_task);
 task_pid_t schedule_get_current_task();
 task_pid_t schedule_get_next_task();
-void schedule_finalize_tasks();
+uint32_t schedule_set_priority(task_pid_t pid, uint8_t priority);
+uint32_t schedule_set_realtime(task_pid_t pid, uint32_t period, uint32_t budget);
+uint32_t schedule_set_affinity(task_pid_t pid, uint32_t affinity);
+void schedule_enqueue(task_pid_t pid);
+void schedule_kick(task_pid_t pid);
+void schedule_skip_ticks(uint32_t ticks);
+cpu_state_t* schedule_exit(cpu_state_t* cpu, uint32_t exit_code);
+uint32_t schedule_collect(task_pid_t pid, uint32_t* exit_code);
+cpu_state_t* schedule_wait_exit(cpu_state_t* cpu);
+uint32_t schedule_get_taskstats(task_pid_t pid, taskstats_t* stats);
+schedstats_t* schedule_get_schedstats();
+void schedule_dump();
+void schedule_init_cpu();
+void schedule_init();
 
 #endif
 
@@ -6,7 +6,11 @@
  * 
  * This controls multitasking. Each tasks has two associated stacks, a kernel
  * stack for interrupt handling and a user stack that serves as user call stack.
- * Also each task has its own page directory and therefore virtual address space.
+ * Also each task has its own page directory and therefore virtual address space,
+ * unless it is a thread: Kernel threads share the kernel page directory and
+ * user threads share the page directory of the task that created them.
+ * The task list is protected by a reader-writer lock, so that the scheduler
+ * (and other readers) on several CPUs can walk it at the same time.
  * @see http://www.lowlevel.eu/wiki/Teil_6_-_Multitasking
  */
 
@@ -14,16 +18,22 @@
 #include <tasks/task.h>
 #include <tasks/schedule.h>
 #include <tasks/elf.h>
+#include <tasks/ring.h>
 #include <interrupts/isr.h>
 #include <mem/gdt.h>
 #include <mem/mmu.h>
 #include <mem/vmm.h>
 #include <boot/multiboot.h>
+#include <hardware/pit.h>
+#include <hardware/cpu/tsc.h>
+#include <lib/spinlock.h>
 #include <string.h>
+#include <syscall.h>
 
 #define MAX_TASKS 1024 ///< maximum number of tasks
 /** Array of tasks. Fixed-size array for now, may change in the future. */
 static task_t* tasks[MAX_TASKS];
+static rwlock_t tasks_lock = RWLOCK_INIT("Task"); ///< protects the task list
 
 /**
  * Returns the internal task structure associated with the given PID.
@@ -39,17 +49,34 @@ static task_t* task_get(task_pid_t pid) {
 }
 
 /**
- * Adds a new task to the task list and associates a PID.
+ * Adds a new task to the task list and associates a PID. New tasks enter the
+ * scheduler's feedback queue on the highest level.
  * @param task the task structure
  * @return the task's PID
  */
 task_pid_t task_add(task_t* task) {
     task_pid_t pid;
+    task->ticks = 0; // the time slice is filled when the task is switched to
+    task->priority = task->base_priority = 0;
+    memset(&task->stats, 0, sizeof(taskstats_t));
+    task->switch_tsc = tsc_read(); // the task is waiting from now on
+    task->fpu_used = 0; // the FPU state is initialized on first use
+    task->parent = 0; // nobody waits for this task unless told otherwise
+    task->exit_code = 0;
+    task->tls = 0; // the TLS segment is flat until sys_set_tls is called
+    memset(&task->realtime, 0, sizeof(task_realtime_t)); // best-effort task
+    task->lock_depth = 1; // tasks start inside the scheduler, see isr_lock_kernel()
+    task->on_cpu = 0;
+    task->affinity = SCHEDULE_ALL_CPUS; // may run anywhere until sys_setaffinity
+    task->ring = 0; // created by sys_ring_setup
+    uint8_t interrupts = rwlock_write_lock_irqsave(&tasks_lock);
     // pid 0 is an error value
     for (pid = 1; tasks[pid] && pid < MAX_TASKS; pid++);
     if (pid == MAX_TASKS)
         panic("Maximum task number reached");
     tasks[pid] = task;
+    rwlock_write_unlock_irqrestore(&tasks_lock, interrupts);
+    schedule_enqueue(pid); // puts the task in the least loaded run queue
     return pid;
 }
 
@@ -58,7 +85,9 @@ task_pid_t task_add(task_t* task) {
  * @param pid the task's PID
  */
 static void task_remove(task_pid_t pid) {
+    uint8_t interrupts = rwlock_write_lock_irqsave(&tasks_lock);
     tasks[pid] = 0;
+    rwlock_write_unlock_irqrestore(&tasks_lock, interrupts);
 }
 
 /**
@@ -75,9 +104,10 @@ static void task_remove(task_pid_t pid) {
 static task_pid_t task_create_detailed(void* entry_point,
         page_directory_t* page_directory, size_t kernel_stack_len,
         size_t user_stack_len, elf_t* elf, size_t code_segment, size_t data_segment) {
-    uint8_t old_interrupts = isr_enable_interrupts(0);
     logln("TASK", "Creating task with %dKB kernel and %dKB user stack",
             kernel_stack_len, user_stack_len);
+    // Nobody knows the task until it is added to the task list, so we only
+    // need the VMM's locking here.
     // Here we allocate a whole page (4KB) which is more than we need.
     // TODO: use a proper heap (malloc)
     task_t* task = vmm_alloc(sizeof(task_t), VMM_KERNEL);
@@ -97,6 +127,12 @@ static task_pid_t task_create_detailed(void* entry_point,
             (task->kernel_stack + kernel_stack_len - 1 - sizeof(cpu_state_t));
     /// Makes an initial CPU state, setting the registers popped off in isr_asm.S.
     cpu->gs = cpu->fs = cpu->es = cpu->ds = gdt_get_selector(data_segment);
+    /// User tasks access their thread-local storage through GS.
+    if (data_segment == GDT_RING3_DATA_SEG)
+        cpu->gs = gdt_get_selector(GDT_TLS_SEG);
+    /// Kernel tasks access the per-CPU data through FS, see smp_get_cpu().
+    if (data_segment == GDT_RING0_DATA_SEG)
+        cpu->fs = gdt_get_selector(GDT_CPU_SEG);
     // We don't need to set ESP because it is discarded by popa. Instead it is
     // set to the pointer value of cpu itself, so the TOS of the kernel stack.
     cpu->r.edi = cpu->r.esi = cpu->r.ebp = cpu->r.ebx =
@@ -114,7 +150,6 @@ static task_pid_t task_create_detailed(void* entry_point,
     // The VM86 values will be ignored so we don't need to set them.
     vmm_modified_page_directory();
     task_pid_t pid = task_add(task); /// Tells the scheduler to run this task.
-    isr_enable_interrupts(old_interrupts);
     return pid;
 }
 
@@ -131,6 +166,18 @@ task_pid_t task_create_kernel(void* entry_point, page_directory_t* page_director
             0, 0, GDT_RING0_CODE_SEG, GDT_RING0_DATA_SEG);
 }
 
+/**
+ * Creates a kernel thread. Unlike task_create_kernel(), this does not create a
+ * new page directory, so switching between kernel threads is cheaper.
+ * @param entry_point      the virtual address where to start execution
+ * @param kernel_stack_len number of bytes to allocate for the kernel stack
+ * @return the task's PID
+ */
+task_pid_t task_create_kernel_thread(void* entry_point, size_t kernel_stack_len) {
+    return task_create_kernel(entry_point, vmm_get_kernel_page_directory(),
+            kernel_stack_len);
+}
+
 /**
  * Creates a user task.
  * @param entry_point      the virtual address where to start execution
@@ -146,6 +193,36 @@ task_pid_t task_create_user(void* entry_point, page_directory_t* page_directory,
             user_stack_len, elf, GDT_RING3_CODE_SEG, GDT_RING3_DATA_SEG);
 }
 
+/**
+ * Creates a user thread. The thread shares its parent's page directory (and
+ * ELF file), only the stacks are new. The thread function gets one argument
+ * and must not return, but call sys_exit instead.
+ * @param parent           the PID of the task whose address space to share
+ * @param entry_point      the virtual address where to start execution
+ * @param arg              the argument passed to the thread function
+ * @param kernel_stack_len number of bytes to allocate for the kernel stack
+ * @param user_stack_len   number of bytes to allocate for the user stack
+ * @return the thread's PID
+ */
+task_pid_t task_create_thread(task_pid_t parent, void* entry_point, void* arg,
+        size_t kernel_stack_len, size_t user_stack_len) {
+    // The thread can't run before we are done because this is only called
+    // from a syscall, which holds the kernel lock the scheduler needs.
+    task_t* parent_task = task_get(parent);
+    task_pid_t pid = task_create_user(entry_point, parent_task->page_directory,
+            kernel_stack_len, user_stack_len, parent_task->elf);
+    task_t* task = task_get(pid);
+    /// Pushes the argument and a null return address on the new user stack.
+    uint32_t* esp = (uint32_t*) (task->user_stack + user_stack_len) - 2;
+    vmm_modify_page_directory(task->page_directory);
+    esp[0] = 0;
+    esp[1] = (uint32_t) arg;
+    vmm_modified_page_directory();
+    task->cpu->user_esp = (uint32_t) esp;
+    task->parent = parent; /// The parent may wait for the thread to exit.
+    return pid;
+}
+
 /**
  * Stops a task. This does not remove the task from the task list.
  * @param pid the task's PID
@@ -155,25 +232,113 @@ void task_stop(task_pid_t pid) {
 }
 
 /**
- * Destroys a task. This requires the task to have been stopped before.
+ * Blocks a task. The scheduler does not run it until it is woken up.
  * @param pid the task's PID
  */
-void task_destroy(task_pid_t pid) {
-    uint8_t old_interrupts = isr_enable_interrupts(0);
-    if (task_get(pid)->state == TASK_RUNNING) {
-        println("%4aYou may not destroy a running task%a");
-        return;
+void task_block(task_pid_t pid) {
+    task_get(pid)->state = TASK_BLOCKED;
+}
+
+/**
+ * Wakes up a blocked task so that the scheduler runs it again.
+ * @param pid the task's PID
+ */
+void task_wake(task_pid_t pid) {
+    task_t* task = task_get(pid);
+    if (task->state == TASK_BLOCKED) {
+        task->state = TASK_RUNNING;
+        task->switch_tsc = tsc_read(); // the task is waiting from now on
+        schedule_kick(pid); // an idle CPU might have stopped its tick
     }
-    logln("TASK", "Destroying task %d", pid);
+}
+
+/**
+ * Puts the current task to sleep. The task is blocked and does not consume
+ * any CPU time until it is woken up. Before multitasking is set up (or if
+ * interrupts are disabled), this busy waits instead.
+ * @param ms how many milliseconds to sleep
+ */
+void task_sleep(uint32_t ms) {
+    if (schedule_get_current_task() && isr_get_interrupts())
+        sys_sleep(ms);
+    else
+        pit_sleep(ms);
+}
+
+/**
+ * Returns whether another task uses the same page directory as a given task.
+ * @param pid the task's PID
+ * @return whether the task's page directory is shared
+ */
+uint8_t task_shares_page_directory(task_pid_t pid) {
+    page_directory_t* page_directory = task_get(pid)->page_directory;
+    uint8_t shared = 0, interrupts = rwlock_read_lock_irqsave(&tasks_lock);
+    for (task_pid_t other = 1; other < MAX_TASKS && !shared; other++)
+        shared = other != pid && tasks[other] &&
+                tasks[other]->page_directory == page_directory;
+    rwlock_read_unlock_irqrestore(&tasks_lock, interrupts);
+    return shared;
+}
+
+/**
+ * Releases a stopped task's resources (its stacks and, if no other task uses
+ * it, its page directory). The task becomes a zombie which only holds its exit
+ * code until it is destroyed. The task must not be the current task. Only the
+ * reaper releases tasks, so nobody else modifies the task meanwhile.
+ * @param pid the task's PID
+ */
+void task_release(task_pid_t pid) {
     task_t* task = task_get(pid);
+    if (task->state != TASK_STOPPED) {
+        println("%4aYou may not release a running task%a");
+        return;
+    }
+    logln("TASK", "Releasing task %d", pid);
     vmm_modify_page_directory(task->page_directory);
     vmm_free(task->kernel_stack, task->kernel_stack_len);
     vmm_free(task->user_stack, task->user_stack_len);
+    ring_release(pid);
     vmm_modified_page_directory();
-    vmm_destroy_page_directory(task->page_directory);
+    fpu_forget_task(pid);
+    if (!task_shares_page_directory(pid) &&
+            task->page_directory != vmm_get_kernel_page_directory())
+        vmm_destroy_page_directory(task->page_directory);
+    task->page_directory = 0;
+    task->state = TASK_ZOMBIE;
+}
+
+/**
+ * Destroys a task, removing it from the task list. This requires the task to
+ * have been released before.
+ * @param pid the task's PID
+ */
+void task_destroy(task_pid_t pid) {
+    task_t* task = task_get(pid);
+    if (task->state != TASK_ZOMBIE) {
+        println("%4aYou may not destroy a running task%a");
+        return;
+    }
+    logln("TASK", "Destroying task %d", pid);
+    task_remove(pid); // first remove it so nobody finds the freed task
     vmm_free(task, sizeof(task_t));
-    task_remove(pid);
-    isr_enable_interrupts(old_interrupts);
+}
+
+/**
+ * Tells all children of a task that nobody will wait for them. Children that
+ * are zombies already are destroyed.
+ * @param parent the parent task's PID
+ */
+void task_orphan_children(task_pid_t parent) {
+    for (task_pid_t pid = 1; pid < MAX_TASKS; pid++) {
+        uint8_t zombie = 0, interrupts = rwlock_read_lock_irqsave(&tasks_lock);
+        if (tasks[pid] && tasks[pid]->parent == parent) {
+            tasks[pid]->parent = 0;
+            zombie = tasks[pid]->state == TASK_ZOMBIE;
+        }
+        rwlock_read_unlock_irqrestore(&tasks_lock, interrupts);
+        if (zombie) // destroying needs the write lock
+            task_destroy(pid);
+    }
 }
 
 /**
@@ -182,12 +347,14 @@ void task_destroy(task_pid_t pid) {
  * @return the next task's PID
  */
 task_pid_t task_get_next_task(task_pid_t pid) {
+    uint8_t interrupts = rwlock_read_lock_irqsave(&tasks_lock);
     for (pid++; pid < MAX_TASKS && !tasks[pid]; pid++);
     if (pid == MAX_TASKS) {
         for (pid = 1; pid < MAX_TASKS && !tasks[pid]; pid++);
         if (pid == MAX_TASKS)
-            return 0;
+            pid = 0;
     }
+    rwlock_read_unlock_irqrestore(&tasks_lock, interrupts);
     return pid;
 }
 
@@ -210,12 +377,31 @@ task_pid_t task_get_next_task_with_state(task_pid_t pid, task_state_t state) {
     return pid;
 }
 
+/**
+ * Returns whether a task with the given PID exists. Unlike the other task
+ * functions, this may be called with PIDs passed in from user space.
+ * @param pid the task's PID
+ * @return whether the task exists
+ */
+uint8_t task_exists(task_pid_t pid) {
+    return pid > 0 && pid < MAX_TASKS && tasks[pid];
+}
+
+/**
+ * Returns a task's state.
+ * @param pid the task's PID
+ * @return the task's state
+ */
+task_state_t task_get_state(task_pid_t pid) {
+    return task_get(pid)->state;
+}
+
 /**
  * Returns a task's number of remaining ticks.
  * @param pid the task's PID
  * @return the task's number of remaining ticks
  */
-task_state_t task_get_ticks(task_pid_t pid) {
+uint32_t task_get_ticks(task_pid_t pid) {
     return task_get(pid)->ticks;
 }
 
@@ -232,6 +418,42 @@ uint32_t task_set_ticks(task_pid_t pid, uint32_t ticks) {
     return old_ticks;
 }
 
+/**
+ * Returns a task's current priority level.
+ * @param pid the task's PID
+ * @return the task's priority level
+ */
+uint8_t task_get_priority(task_pid_t pid) {
+    return task_get(pid)->priority;
+}
+
+/**
+ * Sets a task's current priority level.
+ * @param pid      the task's PID
+ * @param priority the task's new priority level
+ */
+void task_set_priority(task_pid_t pid, uint8_t priority) {
+    task_get(pid)->priority = priority;
+}
+
+/**
+ * Returns a task's base priority.
+ * @param pid the task's PID
+ * @return the task's base priority
+ */
+uint8_t task_get_base_priority(task_pid_t pid) {
+    return task_get(pid)->base_priority;
+}
+
+/**
+ * Sets a task's base priority.
+ * @param pid           the task's PID
+ * @param base_priority the task's new base priority
+ */
+void task_set_base_priority(task_pid_t pid, uint8_t base_priority) {
+    task_get(pid)->base_priority = base_priority;
+}
+
 /**
  * Returns a task's CPU state.
  * @param pid the task's PID
@@ -277,10 +499,283 @@ void* task_get_elf(task_pid_t pid) {
     return task_get(pid)->elf;
 }
 
+/**
+ * Returns a task's sleep timer.
+ * @param pid the task's PID
+ * @return the task's timer
+ */
+timer_t* task_get_timer(task_pid_t pid) {
+    return &task_get(pid)->timer;
+}
+
+/**
+ * Returns the next task in the wait queue a task blocks on.
+ * @param pid the task's PID
+ * @return the next waiting task's PID or 0
+ */
+task_pid_t task_get_wait_next(task_pid_t pid) {
+    return task_get(pid)->wait_next;
+}
+
+/**
+ * Sets the next task in the wait queue a task blocks on.
+ * @param pid       the task's PID
+ * @param wait_next the next waiting task's PID or 0
+ */
+void task_set_wait_next(task_pid_t pid, task_pid_t wait_next) {
+    task_get(pid)->wait_next = wait_next;
+}
+
+/**
+ * Returns a task's CPU accounting.
+ * @param pid the task's PID
+ * @return the task's statistics
+ */
+taskstats_t* task_get_stats(task_pid_t pid) {
+    return &task_get(pid)->stats;
+}
+
+/**
+ * Returns when a task was last switched or woken up.
+ * @param pid the task's PID
+ * @return the TSC value
+ */
+uint64_t task_get_switch_tsc(task_pid_t pid) {
+    return task_get(pid)->switch_tsc;
+}
+
+/**
+ * Sets when a task was last switched or woken up.
+ * @param pid        the task's PID
+ * @param switch_tsc the TSC value
+ */
+void task_set_switch_tsc(task_pid_t pid, uint64_t switch_tsc) {
+    task_get(pid)->switch_tsc = switch_tsc;
+}
+
+/**
+ * Returns the task that may wait for a task.
+ * @param pid the task's PID
+ * @return the parent's PID or 0
+ */
+task_pid_t task_get_parent(task_pid_t pid) {
+    return task_get(pid)->parent;
+}
+
+/**
+ * Sets the task that may wait for a task.
+ * @param pid    the task's PID
+ * @param parent the parent's PID or 0
+ */
+void task_set_parent(task_pid_t pid, task_pid_t parent) {
+    task_get(pid)->parent = parent;
+}
+
+/**
+ * Returns a task's exit code.
+ * @param pid the task's PID
+ * @return the value the task passed to sys_exit
+ */
+uint32_t task_get_exit_code(task_pid_t pid) {
+    return task_get(pid)->exit_code;
+}
+
+/**
+ * Sets a task's exit code.
+ * @param pid       the task's PID
+ * @param exit_code the value the task passed to sys_exit
+ */
+void task_set_exit_code(task_pid_t pid, uint32_t exit_code) {
+    task_get(pid)->exit_code = exit_code;
+}
+
+/**
+ * Returns whether a task has used the FPU yet.
+ * @param pid the task's PID
+ * @return whether the task has an FPU state
+ */
+uint8_t task_get_fpu_used(task_pid_t pid) {
+    return task_get(pid)->fpu_used;
+}
+
+/**
+ * Sets whether a task has used the FPU yet.
+ * @param pid      the task's PID
+ * @param fpu_used whether the task has an FPU state
+ */
+void task_set_fpu_used(task_pid_t pid, uint8_t fpu_used) {
+    task_get(pid)->fpu_used = fpu_used;
+}
+
+/**
+ * Returns a task's saved FPU/SSE registers.
+ * @param pid the task's PID
+ * @return the task's FPU state
+ */
+fpu_state_t* task_get_fpu_state(task_pid_t pid) {
+    return &task_get(pid)->fpu_state;
+}
+
+/**
+ * Returns where a task's thread-local storage begins.
+ * @param pid the task's PID
+ * @return the base of the task's TLS segment
+ */
+uint32_t task_get_tls(task_pid_t pid) {
+    return task_get(pid)->tls;
+}
+
+/**
+ * Sets where a task's thread-local storage begins.
+ * @param pid the task's PID
+ * @param tls the base of the task's TLS segment
+ */
+void task_set_tls(task_pid_t pid, uint32_t tls) {
+    task_get(pid)->tls = tls;
+}
+
+/**
+ * Returns a task's real-time parameters.
+ * @param pid the task's PID
+ * @return the real-time parameters
+ */
+task_realtime_t* task_get_realtime(task_pid_t pid) {
+    return &task_get(pid)->realtime;
+}
+
+/**
+ * Returns how often a task holds the kernel lock. Saved and restored on task
+ * switches because the lock is counted per CPU.
+ * @param pid the task's PID
+ * @return the lock depth
+ */
+uint32_t task_get_lock_depth(task_pid_t pid) {
+    return task_get(pid)->lock_depth;
+}
+
+/**
+ * Sets how often a task holds the kernel lock.
+ * @param pid        the task's PID
+ * @param lock_depth the lock depth
+ */
+void task_set_lock_depth(task_pid_t pid, uint32_t lock_depth) {
+    task_get(pid)->lock_depth = lock_depth;
+}
+
+/**
+ * Returns whether a task is running on some CPU right now. Such a task may
+ * not be picked by another CPU's scheduler.
+ * @param pid the task's PID
+ * @return whether the task is running on a CPU
+ */
+uint8_t task_get_on_cpu(task_pid_t pid) {
+    return task_get(pid)->on_cpu;
+}
+
+/**
+ * Sets whether a task is running on some CPU right now.
+ * @param pid    the task's PID
+ * @param on_cpu whether the task is running on a CPU
+ */
+void task_set_on_cpu(task_pid_t pid, uint8_t on_cpu) {
+    task_get(pid)->on_cpu = on_cpu;
+}
+
+/**
+ * Returns the CPU whose run queue a task is in.
+ * @param pid the task's PID
+ * @return the CPU's ID or SCHEDULE_NO_QUEUE
+ */
+uint32_t task_get_queue(task_pid_t pid) {
+    return task_get(pid)->queue;
+}
+
+/**
+ * Sets the CPU whose run queue a task is in.
+ * @param pid   the task's PID
+ * @param queue the CPU's ID or SCHEDULE_NO_QUEUE
+ */
+void task_set_queue(task_pid_t pid, uint32_t queue) {
+    task_get(pid)->queue = queue;
+}
+
+/**
+ * Returns the next task in a task's run queue.
+ * @param pid the task's PID
+ * @return the next task's PID
+ */
+task_pid_t task_get_run_next(task_pid_t pid) {
+    return task_get(pid)->run_next;
+}
+
+/**
+ * Sets the next task in a task's run queue.
+ * @param pid      the task's PID
+ * @param run_next the next task's PID
+ */
+void task_set_run_next(task_pid_t pid, task_pid_t run_next) {
+    task_get(pid)->run_next = run_next;
+}
+
+/**
+ * Returns the previous task in a task's run queue.
+ * @param pid the task's PID
+ * @return the previous task's PID
+ */
+task_pid_t task_get_run_prev(task_pid_t pid) {
+    return task_get(pid)->run_prev;
+}
+
+/**
+ * Sets the previous task in a task's run queue.
+ * @param pid      the task's PID
+ * @param run_prev the previous task's PID
+ */
+void task_set_run_prev(task_pid_t pid, task_pid_t run_prev) {
+    task_get(pid)->run_prev = run_prev;
+}
+
+/**
+ * Returns the CPUs a task may run on.
+ * @param pid the task's PID
+ * @return a bit mask with bit i set if the task may run on CPU i
+ */
+uint32_t task_get_affinity(task_pid_t pid) {
+    return task_get(pid)->affinity;
+}
+
+/**
+ * Sets the CPUs a task may run on.
+ * @param pid      the task's PID
+ * @param affinity a bit mask with bit i set if the task may run on CPU i
+ */
+void task_set_affinity(task_pid_t pid, uint32_t affinity) {
+    task_get(pid)->affinity = affinity;
+}
+
+/**
+ * Returns a task's submission/completion ring.
+ * @param pid the task's PID
+ * @return the kernel's ring structure or 0 if the task has no ring
+ */
+void* task_get_ring(task_pid_t pid) {
+    return task_get(pid)->ring;
+}
+
+/**
+ * Sets a task's submission/completion ring.
+ * @param pid  the task's PID
+ * @param ring the kernel's ring structure
+ */
+void task_set_ring(task_pid_t pid, void* ring) {
+    task_get(pid)->ring = ring;
+}
+
 /**
  * Dumps the task list. The dump is logged.
  */
 void task_dump() {
+    static char* states[] = {"Stopped", "Running", "Blocked", "Zombie"};
     task_pid_t initial_pid = task_get_next_task(0), pid = initial_pid;
     logln("TASK", "Task list:");
     if (!initial_pid) {
@@ -288,10 +783,16 @@ void task_dump() {
         return;
     }
     do {
-        logln("TASK", "%s task with pid %d%s",
-                task_get(pid)->state ? "Running" : "Stopped", pid,
-                task_get(pid)->vm86 ? " (VM86)" : "");
+        task_t* task = task_get(pid);
+        // cycles are printed in millions because we can only print 32 bits
+        logln("TASK", "%s task with pid %d on level %d (base %d)%s: ran %uM, "
+                "waited %uM cycles, %u voluntary, %u involuntary switches",
+                states[task->state], pid, task->priority, task->base_priority,
+                task->vm86 ? " (VM86)" : "", (uint32_t) (task->stats.run_cycles >> 20),
+                (uint32_t) (task->stats.wait_cycles >> 20),
+                task->stats.voluntary_switches, task->stats.involuntary_switches);
     } while ((pid = task_get_next_task(pid)) && pid != initial_pid);
+    spinlock_dump(&tasks_lock.lock);
 }
 
 /// @}
@@ -10,6 +10,9 @@
 #include <stdint.h>
 #include <interrupts/isr.h>
 #include <mem/vmm.h>
+#include <tasks/timer.h>
+#include <hardware/cpu/fpu.h>
+#include <taskstats.h>
 
 #define _4KB 0x1000 ///< 4KB are 4096 bytes, often used for stacks
 
@@ -18,39 +21,110 @@ typedef uint32_t task_pid_t;  ///< unique process ID
 
 /// state of a task
 typedef enum {
-    TASK_STOPPED, TASK_RUNNING
+    TASK_STOPPED, TASK_RUNNING, TASK_BLOCKED, TASK_ZOMBIE
 } task_state_t;
 
+/// parameters of a real-time task, see schedule_set_realtime()
+typedef struct {
+    uint32_t period;   ///< ticks between two releases, 0 for best-effort tasks
+    uint32_t budget;   ///< ticks the task may run per period
+    uint32_t deadline; ///< PIT tick at which the current period ends
+    uint32_t left;     ///< ticks left of the budget in the current period
+} task_realtime_t;
+
 /// internal representation of a task
 typedef struct {
-    task_state_t state;          ///< whether the task is running or stopped
+    task_state_t state;          ///< whether the task is running, blocked, stopped or a zombie
     page_directory_t* page_directory; ///< this task's virtual memory map
     task_stack_t* kernel_stack;  ///< stack for handling interrupts
     task_stack_t* user_stack;    ///< stack for the actual task's code
     size_t kernel_stack_len,     ///< kernel stack length
             user_stack_len;      ///< user stack length
     cpu_state_t* cpu; ///< saved CPU state when entering/leaving interrupts
-    uint32_t ticks;   ///< how many ticks the task may run per time slice
+    uint32_t ticks;   ///< how many ticks are left in the current time slice
+    uint8_t priority; ///< current feedback queue level (0 is the highest)
+    uint8_t base_priority; ///< the highest level the task may be boosted to
     uint8_t vm86;     ///< whether this task is running in Virtual 8086 mode
     void* elf;        ///< if this is an ELF task, this points to the ELF file
+    timer_t timer;    ///< wakes the task up when it is sleeping
+    task_pid_t wait_next; ///< the next task in the wait queue (or zombie list)
+    taskstats_t stats;    ///< CPU accounting
+    uint64_t switch_tsc;  ///< TSC when the task was last switched or woken
+    task_pid_t parent;    ///< the task that may wait for this task, or 0
+    uint32_t exit_code;   ///< passed to sys_exit, kept until the parent waits
+    uint8_t fpu_used;     ///< whether the task has used the FPU yet
+    fpu_state_t fpu_state; ///< saved FPU/SSE registers, see fpu_switch_task()
+    uint32_t tls;         ///< base of the TLS segment loaded into GS in user space
+    task_realtime_t realtime; ///< only used if the task is a real-time task
+    uint32_t lock_depth;  ///< how often the task holds the kernel lock, see isr_lock_kernel()
+    uint8_t on_cpu;       ///< whether the task is running on some CPU right now
+    uint32_t queue;       ///< the CPU whose run queue the task is in
+    task_pid_t run_next, run_prev; ///< neighbours in that run queue
+    uint32_t affinity;    ///< CPUs the task may run on, one bit per CPU
+    void* ring;           ///< the task's submission/completion ring, see ring.c
 } task_t;
 
 task_pid_t task_add(task_t* task);
 task_pid_t task_create_kernel(void* entry_point, page_directory_t* page_directory,
         size_t kernel_stack_len);
+task_pid_t task_create_kernel_thread(void* entry_point, size_t kernel_stack_len);
 task_pid_t task_create_user(void* entry_point, page_directory_t* page_directory,
         size_t kernel_stack_len, size_t user_stack_len, void* elf);
+task_pid_t task_create_thread(task_pid_t parent, void* entry_point, void* arg,
+        size_t kernel_stack_len, size_t user_stack_len);
 void task_stop(task_pid_t pid);
+void task_block(task_pid_t pid);
+void task_wake(task_pid_t pid);
+void task_sleep(uint32_t ms);
+uint8_t task_shares_page_directory(task_pid_t pid);
+void task_release(task_pid_t pid);
 void task_destroy(task_pid_t pid);
+void task_orphan_children(task_pid_t parent);
 task_pid_t task_get_next_task(task_pid_t pid);
 task_pid_t task_get_next_task_with_state(task_pid_t pid, task_state_t state);
-task_state_t task_get_ticks(task_pid_t pid);
+uint8_t task_exists(task_pid_t pid);
+task_state_t task_get_state(task_pid_t pid);
+uint32_t task_get_ticks(task_pid_t pid);
 uint32_t task_set_ticks(task_pid_t pid, uint32_t ticks);
+uint8_t task_get_priority(task_pid_t pid);
+void task_set_priority(task_pid_t pid, uint8_t priority);
+uint8_t task_get_base_priority(task_pid_t pid);
+void task_set_base_priority(task_pid_t pid, uint8_t base_priority);
 cpu_state_t* task_get_cpu(task_pid_t pid);
 void task_set_cpu(task_pid_t pid, cpu_state_t* cpu);
 page_directory_t* task_get_page_directory(task_pid_t pid);
 uint8_t task_get_vm86(task_pid_t pid);
 void* task_get_elf(task_pid_t pid);
+timer_t* task_get_timer(task_pid_t pid);
+task_pid_t task_get_wait_next(task_pid_t pid);
+void task_set_wait_next(task_pid_t pid, task_pid_t wait_next);
+taskstats_t* task_get_stats(task_pid_t pid);
+uint64_t task_get_switch_tsc(task_pid_t pid);
+void task_set_switch_tsc(task_pid_t pid, uint64_t switch_tsc);
+task_pid_t task_get_parent(task_pid_t pid);
+void task_set_parent(task_pid_t pid, task_pid_t parent);
+uint32_t task_get_exit_code(task_pid_t pid);
+void task_set_exit_code(task_pid_t pid, uint32_t exit_code);
+uint8_t task_get_fpu_used(task_pid_t pid);
+void task_set_fpu_used(task_pid_t pid, uint8_t fpu_used);
+fpu_state_t* task_get_fpu_state(task_pid_t pid);
+uint32_t task_get_tls(task_pid_t pid);
+void task_set_tls(task_pid_t pid, uint32_t tls);
+task_realtime_t* task_get_realtime(task_pid_t pid);
+uint32_t task_get_lock_depth(task_pid_t pid);
+void task_set_lock_depth(task_pid_t pid, uint32_t lock_depth);
+uint8_t task_get_on_cpu(task_pid_t pid);
+void task_set_on_cpu(task_pid_t pid, uint8_t on_cpu);
+uint32_t task_get_queue(task_pid_t pid);
+void task_set_queue(task_pid_t pid, uint32_t queue);
+task_pid_t task_get_run_next(task_pid_t pid);
+void task_set_run_next(task_pid_t pid, task_pid_t run_next);
+task_pid_t task_get_run_prev(task_pid_t pid);
+void task_set_run_prev(task_pid_t pid, task_pid_t run_prev);
+uint32_t task_get_affinity(task_pid_t pid);
+void task_set_affinity(task_pid_t pid, uint32_t affinity);
+void* task_get_ring(task_pid_t pid);
+void task_set_ring(task_pid_t pid, void* ring);
 void task_dump();
 
 #endif
@@ -0,0 +1,184 @@
+/**
+ * @file
+ * @addtogroup timer
+ * @{
+ * Timer Wheel
+ * 
+ * The timer wheel calls a function after a given number of PIT ticks. It has
+ * TIMER_LEVELS levels of TIMER_SLOTS slots each. A slot on level 0 holds the
+ * timers due on one tick, a slot on the next level covers TIMER_SLOTS times
+ * as many ticks and so on. A timer is put into the lowest level whose range
+ * reaches its deadline. Whenever level 0 wraps around, the next slot of level
+ * 1 is cascaded, that is, its timers are distributed over level 0 (and when
+ * level 1 wraps around, level 2 is cascaded likewise). So adding and
+ * cancelling a timer takes constant time, a timer is moved at most
+ * TIMER_LEVELS - 1 times and on every tick only one slot needs to be checked.
+ * Timers further away than the whole wheel wait in the last level and are
+ * cascaded again until they come into range.
+ * Timers do not allocate memory, the caller provides the timer structure
+ * (e.g. a task embeds its own sleep timer). Deadlines are compared using their
+ * signed difference, so the wheel keeps working when the tick counter
+ * overflows. The wheel is protected by the kernel lock.
+ * Timers are fired by the boot CPU. When its tick is stopped, it wakes up in
+ * time for the first timer, see schedule_stop_tick().
+ * @see http://wiki.osdev.org/Blocking_Process
+ * @see http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+ */
+
+#include <common.h>
+#include <tasks/timer.h>
+#include <hardware/pit.h>
+#include <interrupts/isr.h>
+#include <hardware/cpu/lapic.h>
+#include <hardware/cpu/smp.h>
+
+#define TIMER_LEVELS    4 ///< number of levels, together they cover 2^24 ticks
+#define TIMER_SLOT_BITS 6 ///< each level has 2^6 slots
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
+#define TIMER_MAX_TICKS ((1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1) ///< the farthest deadline in range
+
+static timer_t* wheel[TIMER_LEVELS][TIMER_SLOTS] = {{0}}; ///< pending timers
+static uint32_t wheel_ticks = 0; ///< the next tick to process, all earlier ticks are done
+
+/**
+ * Returns a tick's slot on a given level.
+ * @param ticks the tick
+ * @param level the level
+ * @return the slot's index
+ */
+static inline uint32_t timer_get_slot(uint32_t ticks, uint8_t level) {
+    return (ticks >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+}
+
+/**
+ * Puts a timer into the slot that covers its deadline.
+ * @param timer the timer
+ */
+static void timer_enqueue(timer_t* timer) {
+    uint32_t ticks = timer->deadline - wheel_ticks;
+    uint8_t level = 0;
+    if ((int32_t) ticks < 0)
+        ticks = 0; /// Overdue timers fire on the next tick.
+    if (ticks > TIMER_MAX_TICKS)
+        ticks = TIMER_MAX_TICKS; /// Far timers wait in the last level.
+    while (ticks >> ((level + 1) * TIMER_SLOT_BITS))
+        level++;
+    timer_t** slot = &wheel[level][timer_get_slot(wheel_ticks + ticks, level)];
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->prev = &timer->next;
+    timer->prev = slot;
+    *slot = timer;
+}
+
+/**
+ * Takes a pending timer out of its slot.
+ * @param timer the timer
+ */
+static void timer_dequeue(timer_t* timer) {
+    *timer->prev = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->prev = 0;
+}
+
+/**
+ * Distributes the timers in the current slot of a level over the lower levels.
+ * @param level the level, at least 1
+ * @return the slot's index, the next level is cascaded if this is 0
+ */
+static uint32_t timer_cascade(uint8_t level) {
+    uint32_t index = timer_get_slot(wheel_ticks, level);
+    timer_t* timer = wheel[level][index];
+    wheel[level][index] = 0;
+    while (timer) {
+        timer_t* next = timer->next;
+        timer_enqueue(timer);
+        timer = next;
+    }
+    return index;
+}
+
+/**
+ * Starts a timer. The timer must not be pending already.
+ * @param timer    the timer structure, must stay valid until the timer fires
+ * @param ticks    how many ticks from now the timer fires
+ * @param callback the function to call
+ * @param data     passed to the callback
+ */
+void timer_add(timer_t* timer, uint32_t ticks, timer_callback_t callback, void* data) {
+    uint8_t old_interrupts = isr_enable_interrupts(0);
+    /// While the boot CPU's tick is stopped, the clock lags behind, so the
+    /// deadline is computed from the current time instead.
+    uint32_t now = pit_get_current_ticks();
+    /// The boot CPU might sleep longer than the new timer, so it needs to
+    /// reschedule.
+    if (smp_get_cpu_by_id(0)->tickless && ticks < timer_get_ticks_left(now))
+        lapic_timer_kick(0);
+    timer->deadline = now + ticks;
+    timer->callback = callback;
+    timer->data = data;
+    timer_enqueue(timer);
+    isr_enable_interrupts(old_interrupts);
+}
+
+/**
+ * Stops a pending timer.
+ * @param timer the timer structure
+ * @return whether the timer was pending
+ */
+uint8_t timer_cancel(timer_t* timer) {
+    uint8_t old_interrupts = isr_enable_interrupts(0), pending = timer->prev != 0;
+    if (pending)
+        timer_dequeue(timer);
+    isr_enable_interrupts(old_interrupts);
+    return pending;
+}
+
+/**
+ * Fires all timers that are due. Called by the PIT on every tick, catches up
+ * on the ticks the boot CPU slept through.
+ * @param ticks the current tick
+ */
+void timer_handle_tick(uint32_t ticks) {
+    while ((int32_t) (ticks - wheel_ticks) >= 0) {
+        if (!timer_get_slot(wheel_ticks, 0))
+            for (uint8_t level = 1; level < TIMER_LEVELS && !timer_cascade(level); level++);
+        timer_t** slot = &wheel[0][timer_get_slot(wheel_ticks, 0)];
+        while (*slot) {
+            timer_t* timer = *slot;
+            timer_dequeue(timer); /// Removes the timer first so the callback
+            timer->callback(timer->data); /// may start it again.
+        }
+        wheel_ticks++;
+    }
+}
+
+/**
+ * Returns how many ticks are left until the next timer fires. Timers on
+ * higher levels are only known up to their slot, so this might instead be
+ * the time until they are cascaded (which is never too late).
+ * @param ticks the current tick
+ * @return the number of ticks, 0 if a timer is due or -1 if no timer is pending
+ */
+uint32_t timer_get_ticks_left(uint32_t ticks) {
+    uint32_t left = -1;
+    for (uint8_t level = 0; level < TIMER_LEVELS; level++) {
+        uint8_t shift = level * TIMER_SLOT_BITS;
+        /// A slot is processed (on level 0) or cascaded when all lower bits
+        /// of the tick are 0, the first such tick is rounded up from now.
+        uint32_t first = (wheel_ticks + (1 << shift) - 1) >> shift;
+        for (uint32_t i = 0; i < TIMER_SLOTS; i++)
+            if (wheel[level][(first + i) & (TIMER_SLOTS - 1)]) {
+                uint32_t slot_ticks = ((first + i) << shift) - ticks;
+                if ((int32_t) slot_ticks <= 0)
+                    return 0;
+                if (slot_ticks < left)
+                    left = slot_ticks;
+                break;
+            }
+    }
+    return left;
+}
+
+/// @}
@@ -0,0 +1,31 @@
+/**
+ * @file
+ * @addtogroup timer
+ * @{
+ */
+
+#ifndef TASKS_TIMER_H
+#define TASKS_TIMER_H
+
+#include <stdint.h>
+
+/// function called when a timer fires, with interrupts disabled
+typedef void (*timer_callback_t)(void* data);
+
+/// a timer, usually embedded in the structure it belongs to
+typedef struct timer {
+    uint32_t deadline;         ///< the PIT tick at which the timer fires
+    timer_callback_t callback; ///< called when the timer fires
+    void* data;                ///< passed to the callback
+    struct timer* next;        ///< the next timer in the same slot
+    struct timer** prev;       ///< the pointer to this timer, 0 if it is not pending
+} timer_t;
+
+void timer_add(timer_t* timer, uint32_t ticks, timer_callback_t callback, void* data);
+uint8_t timer_cancel(timer_t* timer);
+void timer_handle_tick(uint32_t ticks);
+uint32_t timer_get_ticks_left(uint32_t ticks);
+
+#endif
+
+/// @}
@@ -4,7 +4,8 @@
  * @{
  * Task State Segment
  * 
- * The TSS stores information for switching from user to kernel space.
+ * The TSS stores information for switching from user to kernel space. Each
+ * CPU has its own TSS because each CPU runs a different task.
  * @see http://wiki.osdev.org/TSS
  * @see https://en.wikipedia.org/wiki/Task_state_segment
  * @see http://www.lowlevel.eu/wiki/Task_State_Segment
@@ -14,6 +15,7 @@
 
 #include <common.h>
 #include <tasks/tss.h>
+#include <hardware/cpu/smp.h>
 
 /// the task state segment
 typedef struct {
@@ -26,30 +28,43 @@ typedef struct {
             iopb : 16; ///< @todo maybe use this for I/O permissions
 } __attribute__((packed)) tss_t;
 
-static tss_t tss; ///< the TSS, for software multitasking we only need one
+/// the TSSs, for software multitasking we only need one per CPU
+static tss_t tss[SMP_MAX_CPUS];
 
 /**
- * Initializes the TSS.
- * @param gdt pointer to the GDT
+ * Initializes a CPU's TSS.
+ * @param gdt pointer to the CPU's GDT
+ * @param cpu the CPU's index
  */
-void tss_init(gdt_entry_t* gdt) {
+void tss_init(gdt_entry_t* gdt, uint32_t cpu) {
     /// Creates a TSS descriptor in the GDT.
-    gdt_init_entry(GDT_TASK_STATE_SEG, (uint32_t) &tss, sizeof(tss));
+    gdt_init_entry(gdt, GDT_TASK_STATE_SEG, (uint32_t) &tss[cpu], sizeof(tss_t));
     gdt[5].ac  = 1; gdt[5].rw = 0; gdt[5].dc = 0; gdt[5].ex = 1; gdt[5].dt = 0;
     gdt[5].dpl = 3; gdt[5].pr = 1; gdt[5].sz = 1; gdt[5].gr = 0;
     /// Sets the TSS's stack segment to the kernel stack segment.
-    tss.ss0 = gdt_get_selector(GDT_RING0_DATA_SEG);
+    tss[cpu].ss0 = gdt_get_selector(GDT_RING0_DATA_SEG);
 }
 
 /**
- * Sets the TSS's kernel stack which is used to handle interrupts.
+ * Sets the current CPU's kernel stack which is used to handle interrupts.
  * @param stack_pointer the kernel stack pointer
  */
 void tss_set_stack(uint32_t stack_pointer) {
-    tss.esp0 = stack_pointer;
+    tss[smp_get_cpu()->id].esp0 = stack_pointer;
 }
 
-/// Loads the TSS into the TR register.
+/**
+ * Returns where a CPU's kernel stack pointer is stored. SYSENTER does not
+ * consult the TSS, so its entry code loads the kernel stack from here.
+ * @param cpu the CPU's index
+ * @return a pointer to the CPU's kernel stack pointer
+ * @see isr_init_sysenter()
+ */
+uint32_t* tss_get_stack_address(uint32_t cpu) {
+    return (uint32_t*) &tss[cpu] + 1; // esp0 is the second dword
+}
+
+/// Loads the current CPU's TSS into the TR register.
 void tss_load() {
     /// Loads the TR (= Task Register) with the TSS's GDT selector.
     uint16_t tss_selector = gdt_get_selector(GDT_TASK_STATE_SEG);
@@ -10,8 +10,9 @@
 #include <stdint.h>
 #include <mem/gdt.h>
 
-void tss_init(gdt_entry_t* gdt);
+void tss_init(gdt_entry_t* gdt, uint32_t cpu);
 void tss_set_stack(uint32_t stack_pointer);
+uint32_t* tss_get_stack_address(uint32_t cpu);
 void tss_load();
 
 #endif
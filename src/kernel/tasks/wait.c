@@ -0,0 +1,89 @@
+/**
+ * @file
+ * @addtogroup wait
+ * @{
+ * Wait Queue
+ * 
+ * A wait queue holds tasks that are blocked until some event occurs, e.g.
+ * until input is available. Tasks are woken up in the order they started
+ * waiting. The queue is linked through the tasks themselves, so adding a task
+ * never allocates memory. A task may only wait on one queue at a time.
+ * Waking is meant to be done from interrupt handlers, so all functions assume
+ * (or make sure) that interrupts are disabled.
+ * @see http://wiki.osdev.org/Blocking_Process
+ */
+
+#include <common.h>
+#include <tasks/wait.h>
+#include <tasks/schedule.h>
+#include <syscall.h>
+
+/**
+ * Appends a task to a wait queue and blocks it.
+ * @param queue the wait queue
+ * @param pid   the task's PID
+ */
+static void wait_enqueue(wait_queue_t* queue, task_pid_t pid) {
+    task_set_wait_next(pid, 0);
+    if (queue->tail)
+        task_set_wait_next(queue->tail, pid);
+    else
+        queue->head = pid;
+    queue->tail = pid;
+    task_block(pid);
+}
+
+/**
+ * Blocks the current task until it is woken up and switches to another task.
+ * Must be called from an interrupt handler (usually a syscall).
+ * @param queue the wait queue
+ * @param cpu   the current task's CPU state
+ * @return the next task's CPU state
+ */
+cpu_state_t* wait_sleep(wait_queue_t* queue, cpu_state_t* cpu) {
+    task_pid_t pid = schedule_get_current_task();
+    if (!pid)
+        return cpu;
+    wait_enqueue(queue, pid);
+    return schedule_yield(cpu);
+}
+
+/**
+ * Blocks the current kernel thread until it is woken up. Unlike wait_sleep(),
+ * this is called from task context. Interrupts should be disabled while
+ * checking the awaited condition and calling this, so no wake-up is missed.
+ * @param queue the wait queue
+ */
+void wait_block(wait_queue_t* queue) {
+    uint8_t old_interrupts = isr_enable_interrupts(0);
+    wait_enqueue(queue, schedule_get_current_task());
+    sys_yield(); // we won't be scheduled again until we are woken up
+    isr_enable_interrupts(old_interrupts);
+}
+
+/**
+ * Wakes up the task that waits longest.
+ * @param queue the wait queue
+ * @return whether a task was woken up
+ */
+uint8_t wait_wake_one(wait_queue_t* queue) {
+    uint8_t old_interrupts = isr_enable_interrupts(0);
+    task_pid_t pid = queue->head;
+    if (pid) {
+        if (!(queue->head = task_get_wait_next(pid)))
+            queue->tail = 0;
+        task_wake(pid);
+    }
+    isr_enable_interrupts(old_interrupts);
+    return pid != 0;
+}
+
+/**
+ * Wakes up all waiting tasks.
+ * @param queue the wait queue
+ */
+void wait_wake_all(wait_queue_t* queue) {
+    while (wait_wake_one(queue));
+}
+
+/// @}
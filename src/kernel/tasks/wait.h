@@ -0,0 +1,27 @@
+/**
+ * @file
+ * @addtogroup wait
+ * @{
+ */
+
+#ifndef TASKS_WAIT_H
+#define TASKS_WAIT_H
+
+#include <stdint.h>
+#include <interrupts/isr.h>
+#include <tasks/task.h>
+
+/// a FIFO of blocked tasks waiting for some event
+typedef struct {
+    task_pid_t head, ///< the task that waits longest
+            tail;    ///< the task that waits shortest
+} wait_queue_t;
+
+cpu_state_t* wait_sleep(wait_queue_t* queue, cpu_state_t* cpu);
+void wait_block(wait_queue_t* queue);
+uint8_t wait_wake_one(wait_queue_t* queue);
+void wait_wake_all(wait_queue_t* queue);
+
+#endif
+
+/// @}
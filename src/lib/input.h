@@ -0,0 +1,34 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+
+#define INPUT_KEYBOARD 1
+#define INPUT_MOUSE    2
+
+#define INPUT_SHIFT       0x01 // modifier flags of keyboard events
+#define INPUT_CTRL        0x02
+#define INPUT_GUI         0x04
+#define INPUT_ALT         0x08
+#define INPUT_SCROLL_LOCK 0x10
+#define INPUT_NUM_LOCK    0x20
+#define INPUT_CAPS_LOCK   0x40
+
+#define INPUT_LEFT   0x01 // mouse buttons
+#define INPUT_RIGHT  0x02
+#define INPUT_MIDDLE 0x04
+
+typedef struct {
+    uint8_t type; // INPUT_KEYBOARD or INPUT_MOUSE
+    // keyboard events
+    uint8_t keycode; // which key was pressed / released
+    uint8_t pressed; // whether the key was pressed (1) or released (0)
+    uint8_t ascii;   // a corresponding ASCII character (if any), otherwise 0
+    uint8_t flags;   // which modifier keys are pressed / locked
+    // mouse events
+    uint8_t buttons; // which mouse buttons are pressed
+    uint8_t screen_x, screen_y; // mouse position on screen
+    uint16_t x, y;   // intern mouse coordinates
+} input_event_t; // input event as seen by user tasks
+
+#endif
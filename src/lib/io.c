@@ -3,8 +3,48 @@
 
 #define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
 
-static putchar_func_t io_putchar_stub = sys_io_putchar;
-static attr_func_t io_attr_stub = sys_io_attr;
+#define IO_BUFFER_SIZE 128
+
+// In user space, characters are collected in a buffer and written with one sys_write when a line is complete, the
+// buffer is full, the attribute changes or a print call returns. The kernel replaces the stubs with direct ones.
+// Threads of a process share the buffer, so print calls take turns.
+static char buffer[IO_BUFFER_SIZE];
+static uint32_t buffer_len = 0;
+static volatile uint32_t buffer_lock = 0;
+
+void io_flush() {
+    if (buffer_len)
+        sys_write(IO_STDOUT, buffer, buffer_len);
+    buffer_len = 0;
+}
+
+static uint16_t io_putchar_buffered(uint8_t c) {
+    buffer[buffer_len++] = c;
+    if (c == '\n' || buffer_len == IO_BUFFER_SIZE)
+        io_flush();
+    return 1;
+}
+
+static uint8_t io_attr_buffered(uint8_t attr) {
+    io_flush(); // characters before the attribute change keep the old attribute
+    return sys_io_attr(attr);
+}
+
+static putchar_func_t io_putchar_stub = io_putchar_buffered;
+static attr_func_t io_attr_stub = io_attr_buffered;
+
+static void io_lock_buffer() {
+    if (io_putchar_stub == io_putchar_buffered)
+        while (__sync_lock_test_and_set(&buffer_lock, 1))
+            sys_yield();
+}
+
+static void io_unlock_buffer() {
+    if (io_putchar_stub == io_putchar_buffered) {
+        io_flush();
+        __sync_lock_release(&buffer_lock);
+    }
+}
 
 void io_set_stubs(putchar_func_t _io_putchar_stub, attr_func_t _io_attr_stub) {
     io_putchar_stub = _io_putchar_stub;
@@ -100,11 +140,17 @@ uint16_t vprint(char* fmt, uint32_t* arg, putchar_func_t putchar_func) {
 }
 
 uint16_t print(char* fmt, ...) {
-    return vprint(fmt, (uint32_t*) &fmt, io_putchar_stub);
+    io_lock_buffer();
+    uint16_t count = vprint(fmt, (uint32_t*) &fmt, io_putchar_stub);
+    io_unlock_buffer();
+    return count;
 }
 
 uint16_t println(char* fmt, ...) {
-    return vprint(fmt, (uint32_t*) &fmt, io_putchar_stub) + io_putchar_stub('\n');
+    io_lock_buffer();
+    uint16_t count = vprint(fmt, (uint32_t*) &fmt, io_putchar_stub) + io_putchar_stub('\n');
+    io_unlock_buffer();
+    return count;
 }
 
 uint16_t fprint(putchar_func_t putchar_func, char* fmt, ...) {
@@ -0,0 +1,22 @@
+#ifndef IRQSTATS_H
+#define IRQSTATS_H
+
+#include <stdint.h>
+
+#define IRQSTATS_VECTORS 256 // interrupt vectors, like IDT_ENTRIES in the kernel
+#define IRQSTATS_CPUS 16     // maximum number of CPUs, like SMP_MAX_CPUS in the kernel
+
+typedef struct {
+    uint32_t vector;       // the interrupt vector these statistics belong to
+    uint32_t count;        // how often the vector fired
+    uint64_t total_cycles; // TSC cycles spent handling it
+    uint32_t max_cycles;   // the longest time spent handling it
+    uint64_t since_last;   // TSC cycles since it last fired, 0 if it never did
+    // the following are global and the same for every vector
+    uint32_t spurious_irq7, spurious_irq15; // spurious IRQs from the master and slave PIC
+    uint32_t cpus; // number of running CPUs
+    uint32_t irqs_off_max[IRQSTATS_CPUS];   // longest time each CPU ran with interrupts disabled
+    uint32_t irqs_off_where[IRQSTATS_CPUS]; // where that happened, a vector or a kernel address
+} irqstats_t; // interrupt statistics
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+// A submission and a completion ring shared by a task and the kernel (see sys_ring_setup). The task queues requests
+// at sq_tail and hands them to the kernel with one sys_ring_enter. The kernel appends their results at cq_tail, where
+// the task picks them up without trapping. Indices only grow, entries live at index % RING_ENTRIES.
+
+#define RING_ENTRIES 64 // entries per ring
+
+typedef enum {
+    RING_NOP,     // completes immediately with result 0
+    RING_WRITE,   // like sys_write(arg[0], arg[1], arg[2])
+    RING_TIMEOUT  // completes with result 0 after arg[0] milliseconds
+} ring_op_t;
+
+typedef struct {
+    uint32_t op;        // a ring_op_t
+    uint32_t arg[3];    // the operation's parameters
+    uint32_t user_data; // passed through to the completion
+} ring_sqe_t; // submission queue entry
+
+typedef struct {
+    uint32_t user_data; // from the submission
+    uint32_t result;    // the operation's return value
+} ring_cqe_t; // completion queue entry
+
+typedef struct {
+    volatile uint32_t sq_head, sq_tail; // the kernel consumes at the head, the task produces at the tail
+    volatile uint32_t cq_head, cq_tail; // the task consumes at the head, the kernel produces at the tail
+    ring_sqe_t sq[RING_ENTRIES];
+    ring_cqe_t cq[RING_ENTRIES];
+} ring_t;
+
+// returns a free submission entry or 0 if the ring is full, it is submitted with ring_submit
+static inline ring_sqe_t* ring_get_sqe(ring_t* ring) {
+    if (ring->sq_tail - ring->sq_head == RING_ENTRIES)
+        return 0;
+    return &ring->sq[ring->sq_tail % RING_ENTRIES];
+}
+
+// publishes the entry returned by ring_get_sqe, the kernel sees it on the next sys_ring_enter
+static inline void ring_submit(ring_t* ring) {
+    asm volatile("" : : : "memory"); // the entry must be written before the tail moves
+    ring->sq_tail++;
+}
+
+// returns the oldest completion or 0 if there is none, it is consumed with ring_advance
+static inline ring_cqe_t* ring_peek_cqe(ring_t* ring) {
+    if (ring->cq_head == ring->cq_tail)
+        return 0;
+    asm volatile("" : : : "memory"); // read the entry only after the tail
+    return &ring->cq[ring->cq_head % RING_ENTRIES];
+}
+
+static inline void ring_advance(ring_t* ring) {
+    asm volatile("" : : : "memory"); // done reading the entry before the kernel may reuse it
+    ring->cq_head++;
+}
+
+#endif
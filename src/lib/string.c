@@ -30,3 +30,12 @@ void* memset(void* ptr, int val, size_t num) {
         *p++ = (uint8_t) val;
     return ptr;
 }
+
+// compares num bytes and returns 0 if they are equal
+int memcmp(const void* ptr1, const void* ptr2, size_t num) {
+    const uint8_t* p1 = ptr1, * p2 = ptr2;
+    for (; num--; p1++, p2++)
+        if (*p1 != *p2)
+            return *p1 - *p2;
+    return 0;
+}
@@ -1,48 +1,100 @@
 #define SHOULD_DEFINE_SYSCALLS
 
+/*
+ * Syscalls enter the kernel with SYSENTER if the CPU supports it, otherwise
+ * with int $0x30. syscall_entry points to the routine to use, the first
+ * syscall finds out which one it is. The routines take the syscall in the
+ * same registers as int $0x30 and preserve every register except EAX.
+ * SYSENTER needs ECX and EDX for the user stack and return address, so we
+ * save them on the stack where the kernel fetches them from (see
+ * isr_handle_sysenter). SYSEXIT always returns to ring 3, so the kernel (which
+ * also links this library) sticks to int $0x30.
+ */
+
+void syscall_detect();
+void (*syscall_entry)() = syscall_detect;
+
+asm(".global syscall_int\n"
+    "syscall_int:\n"
+    "    int $0x30\n"
+    "    ret\n"
+    ".global syscall_sysenter\n"
+    "syscall_sysenter:\n"
+    "    push %edx\n"
+    "    push %ecx\n"
+    "    mov %esp, %ecx\n"
+    "    mov $1f, %edx\n"
+    "    sysenter\n"
+    "1:  pop %ecx\n"
+    "    pop %edx\n"
+    "    ret\n"
+    ".global syscall_detect\n"
+    "syscall_detect:\n"
+    "    push %eax\n"
+    "    push %ebx\n"
+    "    push %ecx\n"
+    "    push %edx\n"
+    "    movl $syscall_int, syscall_entry\n"
+    "    mov %cs, %eax\n"
+    "    test $3, %eax\n" // in ring 0, we are the kernel
+    "    jz 1f\n"
+    "    mov $1, %eax\n"
+    "    cpuid\n"
+    "    test $0x800, %edx\n" // SEP feature flag
+    "    jz 1f\n"
+    "    and $0xFFF, %eax\n" // early Pentium Pros report SEP without having it
+    "    cmp $0x633, %eax\n" // (family 6, model and stepping below 3)
+    "    jb 1f\n"
+    "    movl $syscall_sysenter, syscall_entry\n"
+    "1:  pop %edx\n"
+    "    pop %ecx\n"
+    "    pop %ebx\n"
+    "    pop %eax\n"
+    "    jmp *syscall_entry\n");
+
 #define SYSCALL_0(id, name, return_type) \
     return_type name() { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id) : "memory"); \
         return (return_type) retval; \
     }
 
 #define SYSCALL_1(id, name, return_type, type1) \
     return_type name(type1 ebx) { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id), "b" (ebx)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id), "b" (ebx) : "memory"); \
         return (return_type) retval; \
     }
 
 #define SYSCALL_2(id, name, return_type, type1, type2) \
     return_type name(type1 ebx, type2 ecx) { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id), "b" (ebx), \
-            "c" (ecx)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id), "b" (ebx), \
+            "c" (ecx) : "memory"); \
         return (return_type) retval; \
     }
 
 #define SYSCALL_3(id, name, return_type, type1, type2, type3) \
     return_type name(type1 ebx, type2 ecx, type3 edx) { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id), "b" (ebx), \
-            "c" (ecx), "d" (edx)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id), "b" (ebx), \
+            "c" (ecx), "d" (edx) : "memory"); \
         return (return_type) retval; \
     }
 
 #define SYSCALL_4(id, name, return_type, type1, type2, type3, type4) \
     return_type name(type1 ebx, type2 ecx, type3 edx, type4 esi) { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id), "b" (ebx), \
-            "c" (ecx), "d" (edx), "s" (esi)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id), "b" (ebx), \
+            "c" (ecx), "d" (edx), "s" (esi) : "memory"); \
         return (return_type) retval; \
     }
 
 #define SYSCALL_5(id, name, return_type, type1, type2, type3, type4, type5) \
     return_type name(type1 ebx, type2 ecx, type3 edx, type4 esi, type5 edi) { \
         return_type retval; \
-        asm volatile("int $0x30" : "=a" (retval) : "a" (id), "b" (ebx), \
-            "c" (ecx), "d" (edx), "s" (esi), "d" (edi)); \
+        asm volatile("call *syscall_entry" : "=a" (retval) : "a" (id), "b" (ebx), \
+            "c" (ecx), "d" (edx), "s" (esi), "D" (edi) : "memory"); \
         return (return_type) retval; \
     }
 
@@ -2,6 +2,11 @@
 #define SYSCALL_H
 
 #include <stdint.h>
+#include <input.h>
+#include <taskstats.h>
+#include <ring.h>
+#include <irqstats.h>
+#include <time.h>
 
 #ifndef SHOULD_DEFINE_SYSCALLS
 #define SYSCALL_0(id, name, return_type) \
@@ -18,10 +23,20 @@
     return_type name(type1 ebx, type2 ecx, type3 edx, type4 esi, type5 edi)
 #endif
 
+/// how syscalls enter the kernel, see syscall.c
+extern void (*syscall_entry)();
+void syscall_int();
+void syscall_sysenter();
+
 #define SYSCALL_NUMBER 32
 
 enum {
-    SYSCALL_EXIT, SYSCALL_GETPID, SYSCALL_IO_PUTCHAR, SYSCALL_IO_ATTR
+    SYSCALL_EXIT, SYSCALL_GETPID, SYSCALL_IO_PUTCHAR, SYSCALL_IO_ATTR,
+    SYSCALL_SETPRIORITY, SYSCALL_SLEEP, SYSCALL_READ_INPUT, SYSCALL_YIELD,
+    SYSCALL_YIELD_TO, SYSCALL_TASKSTATS, SYSCALL_SCHEDSTATS, SYSCALL_THREAD_CREATE,
+    SYSCALL_WAITPID, SYSCALL_SET_TLS, SYSCALL_SETREALTIME, SYSCALL_SETAFFINITY,
+    SYSCALL_WRITE, SYSCALL_RING_SETUP, SYSCALL_RING_ENTER, SYSCALL_IRQSTATS,
+    SYSCALL_CLOCK_GETTIME, SYSCALL_IRQAFFINITY
 } syscall_ids;
 
 // sys_exit does not actually return anything, but we cannot declare a void variable :/
@@ -29,6 +44,24 @@ SYSCALL_1(SYSCALL_EXIT,       sys_exit,       uint32_t, uint32_t);
 SYSCALL_0(SYSCALL_GETPID,     sys_getpid,     uint32_t);
 SYSCALL_1(SYSCALL_IO_PUTCHAR, sys_io_putchar, uint16_t, uint8_t);
 SYSCALL_1(SYSCALL_IO_ATTR,    sys_io_attr,    uint8_t,  uint8_t);
+SYSCALL_2(SYSCALL_SETPRIORITY, sys_setpriority, uint32_t, uint32_t, uint32_t);
+SYSCALL_1(SYSCALL_SLEEP,      sys_sleep,      uint32_t, uint32_t);
+SYSCALL_1(SYSCALL_READ_INPUT, sys_read_input, uint32_t, input_event_t*);
+SYSCALL_0(SYSCALL_YIELD,      sys_yield,      uint32_t);
+SYSCALL_1(SYSCALL_YIELD_TO,   sys_yield_to,   uint32_t, uint32_t);
+SYSCALL_2(SYSCALL_TASKSTATS,  sys_taskstats,  uint32_t, uint32_t, taskstats_t*);
+SYSCALL_1(SYSCALL_SCHEDSTATS, sys_schedstats, uint32_t, schedstats_t*);
+SYSCALL_2(SYSCALL_THREAD_CREATE, sys_thread_create, uint32_t, void*, void*);
+SYSCALL_2(SYSCALL_WAITPID,    sys_waitpid,    uint32_t, uint32_t, uint32_t*);
+SYSCALL_1(SYSCALL_SET_TLS,    sys_set_tls,    uint32_t, void*);
+SYSCALL_3(SYSCALL_SETREALTIME, sys_setrealtime, uint32_t, uint32_t, uint32_t, uint32_t);
+SYSCALL_2(SYSCALL_SETAFFINITY, sys_setaffinity, uint32_t, uint32_t, uint32_t);
+SYSCALL_3(SYSCALL_WRITE,      sys_write,      uint32_t, uint32_t, char*, uint32_t);
+SYSCALL_0(SYSCALL_RING_SETUP, sys_ring_setup, ring_t*);
+SYSCALL_2(SYSCALL_RING_ENTER, sys_ring_enter, uint32_t, uint32_t, uint32_t);
+SYSCALL_2(SYSCALL_IRQSTATS,   sys_irqstats,   uint32_t, uint32_t, irqstats_t*);
+SYSCALL_2(SYSCALL_CLOCK_GETTIME, sys_clock_gettime, uint32_t, uint32_t, timespec_t*);
+SYSCALL_2(SYSCALL_IRQAFFINITY, sys_irqaffinity, uint32_t, uint32_t, uint32_t);
 
 #undef SHOULD_DEFINE_SYSCALLS
 #undef SYSCALL_0
@@ -0,0 +1,28 @@
+#ifndef TASKSTATS_H
+#define TASKSTATS_H
+
+#include <stdint.h>
+
+#define TASKSTATS_BUCKETS 32 // histogram bucket i counts values in [2^i, 2^(i+1)) cycles
+#define TASKSTATS_CPUS 16    // maximum number of CPUs, like SMP_MAX_CPUS in the kernel
+
+typedef struct {
+    uint32_t pid, state, priority; // state is 0 (stopped), 1 (running), 2 (blocked) or 3 (zombie)
+    uint64_t run_cycles;  // TSC cycles spent running
+    uint64_t wait_cycles; // TSC cycles spent runnable, but waiting for the CPU
+    uint32_t voluntary_switches;   // how often the task gave up the CPU
+    uint32_t involuntary_switches; // how often the task was preempted
+    uint32_t deadline_misses; // real-time periods that ended before the task got its budget
+} taskstats_t; // CPU accounting of a single task
+
+typedef struct {
+    uint32_t switches; // number of context switches
+    uint32_t run_histogram[TASKSTATS_BUCKETS];     // how long tasks ran before switching
+    uint32_t latency_histogram[TASKSTATS_BUCKETS]; // how long runnable tasks waited
+    uint32_t cpus; // number of running CPUs
+    uint32_t cpu_ticks[TASKSTATS_CPUS];      // timer ticks per CPU
+    uint32_t cpu_idle_ticks[TASKSTATS_CPUS]; // of these, the ticks the CPU was idle
+    uint32_t cpu_migrations[TASKSTATS_CPUS]; // tasks moved to the CPU's run queue
+} schedstats_t; // global scheduler statistics
+
+#endif
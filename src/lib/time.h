@@ -0,0 +1,13 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include <stdint.h>
+
+#define CLOCK_MONOTONIC 1 // time since boot, never jumps (the only clock for now)
+
+typedef struct {
+    uint32_t tv_sec;  // seconds
+    uint32_t tv_nsec; // nanoseconds (0-999999999)
+} timespec_t;
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stdint.h>
+
+// GS points to the block registered with sys_set_tls, so reading a thread-local
+// variable is a single GS-prefixed load (offset is relative to that block).
+static inline uint32_t tls_read(uint32_t offset) {
+    uint32_t value;
+    asm volatile("movl %%gs:(%1), %0" : "=r" (value) : "r" (offset));
+    return value;
+}
+
+static inline void tls_write(uint32_t offset, uint32_t value) {
+    asm volatile("movl %0, %%gs:(%1)" : : "r" (value), "r" (offset) : "memory");
+}
+
+#endif
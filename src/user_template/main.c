@@ -1,7 +1,52 @@
 #include <syscall.h>
+#include <ring.h>
 #include <io.h>
 
+#define ROUNDS 1024 // a multiple of RING_ENTRIES
+
+static uint32_t rdtsc() {
+    uint32_t tsc;
+    asm volatile("rdtsc" : "=a" (tsc) : : "edx");
+    return tsc;
+}
+
+// average cycles per sys_getpid round trip through the given entry routine
+static uint32_t measure_syscall(void (*entry)()) {
+    void (*old_entry)() = syscall_entry;
+    syscall_entry = entry;
+    uint32_t start = rdtsc();
+    for (int i = 0; i < ROUNDS; i++)
+        sys_getpid();
+    uint32_t end = rdtsc();
+    syscall_entry = old_entry;
+    return (end - start) / ROUNDS;
+}
+
+// average cycles per no-op request when submitting a full ring at once
+static uint32_t measure_ring(ring_t* ring) {
+    uint32_t start = rdtsc();
+    for (int i = 0; i < ROUNDS; i += RING_ENTRIES) {
+        for (int j = 0; j < RING_ENTRIES; j++) {
+            ring_sqe_t* sqe = ring_get_sqe(ring);
+            sqe->op = RING_NOP;
+            sqe->user_data = j;
+            ring_submit(ring);
+        }
+        sys_ring_enter(RING_ENTRIES, RING_ENTRIES);
+        while (ring_peek_cqe(ring))
+            ring_advance(ring);
+    }
+    return (rdtsc() - start) / ROUNDS;
+}
+
 void main() {
-    print("%3apid=%d %a", sys_getpid());
+    sys_getpid(); // picks the entry routine
+    ring_t* ring = sys_ring_setup();
+    // cycles per sys_getpid with int 0x30 and with SYSENTER (0 if the CPU lacks it)
+    // and per RING_NOP submitted through the ring
+    print("%3apid=%d (cycles: getpid int 0x30 %d, getpid sysenter %d, ring nop %d) %a",
+            sys_getpid(), measure_syscall(syscall_int),
+            syscall_entry == syscall_sysenter ? measure_syscall(syscall_sysenter) : 0,
+            ring ? measure_ring(ring) : 0);
     sys_exit(0);
 }